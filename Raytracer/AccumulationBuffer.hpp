@@ -0,0 +1,194 @@
+#pragma once
+
+#include "common.hpp"
+#include "Color.hpp"
+#include "Framebuffer.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+	Where a render stands, stored alongside the sums in a checkpoint.
+	The Sampler is counter based, so the seed plus each pixel's sample count is the complete random state.
+*/
+struct AccumulationInfo {
+	uint32_t seed = 0;				// Camera::seed the samples were drawn with
+	uint32_t samplesCompleted = 0;	// samples every still active pixel has taken
+	uint32_t sampleTarget = 0;		// samples per pixel of the whole render, the strata its sample sequence is laid out over
+	uint32_t sampleBegin = 0;		// the run of sample indices [sampleBegin, sampleEnd) the sums were taken over
+	uint32_t sampleEnd = 0;
+};
+
+/*
+	Running per pixel sums for progressive rendering.
+	Rather than only the final average, keep the sum of sample colors, the sum of squared sample
+	luminance and the number of samples taken. That is enough to know every pixel's mean and
+	variance at any point during the render, and to keep adding samples later.
+	Saved to disk as a checkpoint (little endian, sums kept in double so long renders don't lose precision):
+		"RTAB", version, width, height, seed, samplesCompleted, sampleTarget, sampleBegin, sampleEnd
+		colorSum (3 doubles per pixel), luminanceSquaredSum (double), sampleCount (uint32), active (uint8)
+*/
+struct AccumulationBuffer {
+	int width;
+	int height;
+	std::vector<Vec3T<double>> colorSum;	// double whatever Real is, long renders add up a lot of samples
+	std::vector<double> luminanceSquaredSum;
+	std::vector<uint32_t> sampleCount;
+	std::vector<uint8_t> active;	// pixels that still take samples (adaptive sampling clears converged ones)
+
+	AccumulationBuffer(int w, int h) :
+		width(w),
+		height(h),
+		colorSum(static_cast<size_t>(w) * h, Vec3T<double>(0, 0, 0)),
+		luminanceSquaredSum(static_cast<size_t>(w) * h, 0),
+		sampleCount(static_cast<size_t>(w) * h, 0),
+		active(static_cast<size_t>(w) * h, 1)
+	{}
+
+	auto size() const -> size_t { return this->colorSum.size(); }
+	auto addSample(size_t pixel, const Color& c) -> void {
+		auto l = AccumulationBuffer::luminance(c);
+		this->colorSum[pixel] += Vec3T<double>(c);
+		this->luminanceSquaredSum[pixel] += l * l;
+		this->sampleCount[pixel]++;
+	}
+	auto mean(size_t pixel) const -> Color {
+		auto n = this->sampleCount[pixel];
+		return n > 0 ? Color(this->colorSum[pixel] / n) : Color(0, 0, 0);
+	}
+	/*
+		Standard error of the pixel's mean luminance, carried through the gamma 2 display curve
+		(d sqrt(m) = dm / (2 sqrt(m))), so it reads as "how far off could the displayed value still be".
+	*/
+	auto displayError(size_t pixel) const -> double {
+		auto n = this->sampleCount[pixel];
+		if (n < 2) return infinity;
+		auto m = AccumulationBuffer::luminance(this->colorSum[pixel]) / n;
+		auto variance = fmax(0.0, (this->luminanceSquaredSum[pixel] - n * m * m) / (n - 1));
+		auto standardError = sqrt(variance / n);
+		return standardError / (2 * sqrt(fmax(m, 1e-8)));
+	}
+	auto resolve() const -> Framebuffer {
+		Framebuffer image(this->width, this->height);
+		for (size_t p = 0; p < this->size(); p++)
+			image.pixels[p] = this->mean(p);
+		return image;
+	}
+
+	/*
+		Fold in another render of the same frame (other samples, other tiles). Sums and counts simply add,
+		so every pixel ends up weighted by the total number of samples it received across all parts.
+	*/
+	auto merge(const AccumulationBuffer& other) -> bool {
+		if (other.width != this->width || other.height != this->height) return false;
+		for (size_t p = 0; p < this->size(); p++) {
+			this->colorSum[p] += other.colorSum[p];
+			this->luminanceSquaredSum[p] += other.luminanceSquaredSum[p];
+			this->sampleCount[p] += other.sampleCount[p];
+			this->active[p] |= other.active[p];
+		}
+		return true;
+	}
+	/*
+		Written to a temporary file first and renamed over the old checkpoint,
+		so a process killed mid write still leaves the previous checkpoint intact.
+	*/
+	auto save(const std::string& path, const AccumulationInfo& info) const -> bool {
+		auto temporaryPath = path + ".tmp";
+		{
+			std::ofstream out(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!out) {
+				std::cerr << "ERROR: Could not open '" << temporaryPath << "' for writing.\n";
+				return false;
+			}
+			uint32_t header[9] = {
+				AccumulationBuffer::magic, AccumulationBuffer::version,
+				static_cast<uint32_t>(this->width), static_cast<uint32_t>(this->height),
+				info.seed, info.samplesCompleted, info.sampleTarget, info.sampleBegin, info.sampleEnd
+			};
+			out.write(reinterpret_cast<const char*>(header), sizeof(header));
+			std::vector<double> components;
+			components.reserve(this->size() * 3);
+			for (const auto& c : this->colorSum)
+				components.insert(components.end(), { c.x(), c.y(), c.z() });
+			AccumulationBuffer::writeArray(out, components);
+			AccumulationBuffer::writeArray(out, this->luminanceSquaredSum);
+			AccumulationBuffer::writeArray(out, this->sampleCount);
+			AccumulationBuffer::writeArray(out, this->active);
+			out.close(); // a full disk may only show up when the last of the buffer is flushed
+			if (!out) {
+				std::cerr << "ERROR: Failed writing '" << temporaryPath << "'.\n";
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		if (error) {
+			std::cerr << "ERROR: Could not replace '" << path << "': " << error.message() << '\n';
+			return false;
+		}
+		return true;
+	}
+	static auto load(const std::string& path, AccumulationBuffer& buffer, AccumulationInfo& info) -> bool {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in) return false;
+		uint32_t header[9];
+		in.read(reinterpret_cast<char*>(header), sizeof(header));
+		if (!in || header[0] != AccumulationBuffer::magic || header[1] != AccumulationBuffer::version) {
+			std::cerr << "ERROR: '" << path << "' is not a compatible accumulation file.\n";
+			return false;
+		}
+		// sized from the header only once the file is known to hold that many pixels
+		std::error_code error;
+		auto fileSize = std::filesystem::file_size(path, error);
+		auto pixels = static_cast<uint64_t>(header[2]) * header[3];
+		if (error || header[2] > AccumulationBuffer::maxDimension || header[3] > AccumulationBuffer::maxDimension
+			|| fileSize != sizeof(header) + pixels * AccumulationBuffer::bytesPerPixel) {
+			std::cerr << "ERROR: '" << path << "' is not a compatible accumulation file.\n";
+			return false;
+		}
+		AccumulationBuffer loaded(static_cast<int>(header[2]), static_cast<int>(header[3]));
+		std::vector<double> components(loaded.size() * 3);
+		AccumulationBuffer::readArray(in, components);
+		for (size_t p = 0; p < loaded.size(); p++)
+			loaded.colorSum[p] = Vec3T<double>(components[3 * p], components[3 * p + 1], components[3 * p + 2]);
+		AccumulationBuffer::readArray(in, loaded.luminanceSquaredSum);
+		AccumulationBuffer::readArray(in, loaded.sampleCount);
+		AccumulationBuffer::readArray(in, loaded.active);
+		if (!in) {
+			std::cerr << "ERROR: '" << path << "' is truncated.\n";
+			return false;
+		}
+		info.seed = header[4];
+		info.samplesCompleted = header[5];
+		info.sampleTarget = header[6];
+		info.sampleBegin = header[7];
+		info.sampleEnd = header[8];
+		buffer = std::move(loaded);
+		return true;
+	}
+
+	template <typename T>
+	static auto luminance(const Vec3T<T>& c) -> double { // Rec. 709 weights
+		return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+	}
+
+private:
+	static constexpr uint32_t magic = 0x42415452; // "RTAB"
+	static constexpr uint32_t version = 2;
+	static constexpr uint32_t maxDimension = 1 << 16;
+	static constexpr uint64_t bytesPerPixel = 3 * sizeof(double) + sizeof(double) + sizeof(uint32_t) + sizeof(uint8_t);
+
+	template <typename T>
+	static auto writeArray(std::ofstream& out, const std::vector<T>& values) -> void {
+		out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+	}
+	template <typename T>
+	static auto readArray(std::ifstream& in, std::vector<T>& values) -> void {
+		in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T));
+	}
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "common.hpp"
+#include "AxisAlignedBoundingBox.hpp"
+
+/*
+	Affine map p -> L p + t, stored as the 3x4 matrix [ L | t ] (row major).
+	Points go through the whole matrix, directions only through L. Normals have to stay perpendicular
+	to the surface, so they go through the inverse transpose (L^-1)^T instead: transposedVector of the
+	inverse transform, which an Instance keeps anyway.
+	Composing is a matrix product, (a * b) applies b first, so a chain of moves costs one matrix however long it is.
+*/
+struct AffineTransform {
+	Real m[3][4];
+
+	AffineTransform() : m{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } {}
+
+	static auto translation(const Vec3& offset) -> AffineTransform {
+		AffineTransform a;
+		for (int i = 0; i < 3; i++)
+			a.m[i][3] = offset[i];
+		return a;
+	}
+	static auto scaling(const Vec3& factors) -> AffineTransform {
+		AffineTransform a;
+		for (int i = 0; i < 3; i++)
+			a.m[i][i] = factors[i];
+		return a;
+	}
+	/*
+		Rotation by degrees about y, then x, then z (y x z Tait-Bryan angles,
+		https://en.wikipedia.org/wiki/Euler_angles#Rotation_matrix), with c, s the cosine and sine of
+		1: the y angle, 2: the x angle, 3: the z angle
+			[ c1 c3 + s1 s2 s3   c3 s1 s2 - c1 s3   c2 s1
+			  c2 s3              c2 c3              -s2
+			  c1 s2 s3 - c3 s1   c1 c3 s2 + s1 s3   c1 c2 ]
+	*/
+	static auto rotation(const Vec3& degrees) -> AffineTransform {
+		auto c1 = cos(degreesToRadians(degrees.y())), s1 = sin(degreesToRadians(degrees.y()));
+		auto c2 = cos(degreesToRadians(degrees.x())), s2 = sin(degreesToRadians(degrees.x()));
+		auto c3 = cos(degreesToRadians(degrees.z())), s3 = sin(degreesToRadians(degrees.z()));
+		AffineTransform a;
+		a.m[0][0] = c1 * c3 + s1 * s2 * s3;	a.m[0][1] = c3 * s1 * s2 - c1 * s3;	a.m[0][2] = c2 * s1;
+		a.m[1][0] = c2 * s3;				a.m[1][1] = c2 * c3;				a.m[1][2] = -s2;
+		a.m[2][0] = c1 * s2 * s3 - c3 * s1;	a.m[2][1] = c1 * c3 * s2 + s1 * s3;	a.m[2][2] = c1 * c2;
+		return a;
+	}
+
+	auto point(const Point3& p) const -> Point3 {
+		return Point3(
+			this->m[0][0] * p[0] + this->m[0][1] * p[1] + this->m[0][2] * p[2] + this->m[0][3],
+			this->m[1][0] * p[0] + this->m[1][1] * p[1] + this->m[1][2] * p[2] + this->m[1][3],
+			this->m[2][0] * p[0] + this->m[2][1] * p[1] + this->m[2][2] * p[2] + this->m[2][3]
+		);
+	}
+	auto vector(const Vec3& v) const -> Vec3 {
+		return Vec3(
+			this->m[0][0] * v[0] + this->m[0][1] * v[1] + this->m[0][2] * v[2],
+			this->m[1][0] * v[0] + this->m[1][1] * v[1] + this->m[1][2] * v[2],
+			this->m[2][0] * v[0] + this->m[2][1] * v[1] + this->m[2][2] * v[2]
+		);
+	}
+	auto transposedVector(const Vec3& v) const -> Vec3 { // L^T v
+		return Vec3(
+			this->m[0][0] * v[0] + this->m[1][0] * v[1] + this->m[2][0] * v[2],
+			this->m[0][1] * v[0] + this->m[1][1] * v[1] + this->m[2][1] * v[2],
+			this->m[0][2] * v[0] + this->m[1][2] * v[1] + this->m[2][2] * v[2]
+		);
+	}
+	/*
+		L^-1 is the adjugate (transposed cofactors) of L over its determinant, and the offset
+		undoes t: p = L^-1 (p' - t) = L^-1 p' - L^-1 t.
+	*/
+	auto inverse() const -> AffineTransform {
+		const auto& a = this->m;
+		Real cofactor[3][3];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++) {
+				auto i1 = (i + 1) % 3, i2 = (i + 2) % 3, j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+				cofactor[i][j] = a[i1][j1] * a[i2][j2] - a[i1][j2] * a[i2][j1];
+			}
+		auto inverseDeterminant = 1 / (a[0][0] * cofactor[0][0] + a[0][1] * cofactor[0][1] + a[0][2] * cofactor[0][2]);
+		AffineTransform inv;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				inv.m[i][j] = cofactor[j][i] * inverseDeterminant;
+		for (int i = 0; i < 3; i++)
+			inv.m[i][3] = -(inv.m[i][0] * a[0][3] + inv.m[i][1] * a[1][3] + inv.m[i][2] * a[2][3]);
+		return inv;
+	}
+	// whether L only rotates (or mirrors): lengths and angles survive, so unit normals stay unit
+	auto isRigid() const -> bool {
+		static const Real tolerance = 1e-5;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++) {
+				auto d = this->m[0][i] * this->m[0][j] + this->m[1][i] * this->m[1][j] + this->m[2][i] * this->m[2][j];
+				if (std::abs(d - (i == j ? 1 : 0)) > tolerance) return false;
+			}
+		return true;
+	}
+	// s when L is a rotation (or mirror) scaled by s on every axis, so spheres stay spheres of radius * s, 0 otherwise
+	auto uniformScale() const -> Real {
+		static const Real tolerance = 1e-5;
+		auto squared = this->m[0][0] * this->m[0][0] + this->m[1][0] * this->m[1][0] + this->m[2][0] * this->m[2][0];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++) {
+				auto d = this->m[0][i] * this->m[0][j] + this->m[1][i] * this->m[1][j] + this->m[2][i] * this->m[2][j];
+				if (std::abs(d - (i == j ? squared : 0)) > tolerance * squared) return 0;
+			}
+		return sqrt(squared);
+	}
+	/*
+		Box around the transformed box, without transforming its 8 corners (Arvo, Graphics Gems 1990):
+		along each output axis every matrix entry picks whichever end of the input interval makes its
+		term smallest for the lower bound and largest for the upper one.
+	*/
+	auto box(const AxisAlignedBoundingBox& b) const -> AxisAlignedBoundingBox {
+		Interval out[3];
+		for (int i = 0; i < 3; i++) {
+			auto lower = this->m[i][3], upper = this->m[i][3];
+			for (int j = 0; j < 3; j++) {
+				auto e = this->m[i][j] * b.axis(j).min;
+				auto f = this->m[i][j] * b.axis(j).max;
+				lower += e < f ? e : f;
+				upper += e < f ? f : e;
+			}
+			out[i] = Interval(lower, upper);
+		}
+		return AxisAlignedBoundingBox(out[0], out[1], out[2]);
+	}
+};
+
+inline auto operator*(const AffineTransform& a, const AffineTransform& b) -> AffineTransform {
+	AffineTransform r;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+		}
+		r.m[i][3] += a.m[i][3];
+	}
+	return r;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.hpp"
+#include "RayPacket.hpp"
 
 /*
 	Store "volume" in bounding box defined by an interval in x, y and z (thus axis aligned).
@@ -21,9 +22,9 @@ struct AxisAlignedBoundingBox {
 		: x{ ix }, y{ iy }, z{ iz } {}
 	AxisAlignedBoundingBox(const Point3& a, const Point3& b) {
 		// treat two points a and b as extrema for bounding box, so we don't require a particular min/max coordinate order.
-		x = Interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
-		y = Interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
-		z = Interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+		x = Interval(std::fmin(a[0], b[0]), std::fmax(a[0], b[0]));
+		y = Interval(std::fmin(a[1], b[1]), std::fmax(a[1], b[1]));
+		z = Interval(std::fmin(a[2], b[2]), std::fmax(a[2], b[2]));
 	}
 	AxisAlignedBoundingBox(const AxisAlignedBoundingBox& box0, const AxisAlignedBoundingBox& box1) {
 		x = Interval(box0.x, box1.x);
@@ -33,7 +34,7 @@ struct AxisAlignedBoundingBox {
 
 	// return an box that has no side narrower than a static amount
 	auto pad() {
-		static const double delta = 0.0001;
+		static const Real delta = 0.0001;
 		Interval nX = this->x.size() >= delta ? x : x.expand(delta);
 		Interval nY = this->y.size() >= delta ? y : y.expand(delta);
 		Interval nZ = this->z.size() >= delta ? z : z.expand(delta);
@@ -44,15 +45,28 @@ struct AxisAlignedBoundingBox {
 		if (n == 2) return z;
 		return x;
 	}
+	auto centroid() const -> Point3 {
+		return Point3((x.min + x.max) / 2, (y.min + y.max) / 2, (z.min + z.max) / 2);
+	}
+	auto surfaceArea() const -> Real { // 0 for an empty box
+		if (x.size() < 0 || y.size() < 0 || z.size() < 0) return 0;
+		return 2 * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+	}
 	auto hit(const Ray& r, Interval rT) const -> bool {
+		auto direction = r.direction();
+		return this->hit(r.origin(), Vec3(1 / direction[0], 1 / direction[1], 1 / direction[2]), rT);
+	}
+	/*
+		Same test with the reciprocal of the ray's direction (1 / b) worked out by the caller, once per ray
+		instead of once per axis per box. Its sign says which plane of each slab the ray meets first.
+	*/
+	auto hit(const Point3& origin, const Vec3& inverseDirection, Interval rT) const -> bool {
 		for (int a = 0; a < 3; a++) {
-			auto invD = 1 / r.direction()[a];	// 1 / b in axis x, y, or z
-			auto orig = r.origin()[a];			// a	 in axis x, y, or z
-			auto ax = this->axis(a);			// interval of axis (x, y, or z)
-			auto t0 = (ax.min - orig) * invD;
-			auto t1 = (ax.max - orig) * invD;
-			if (invD < 0)
-				std::swap(t0, t1);
+			auto invD = inverseDirection[a];	// 1 / b in axis x, y, or z
+			auto orig = origin[a];				// a	 in axis x, y, or z
+			const auto& ax = this->axis(a);		// interval of axis (x, y, or z)
+			auto t0 = ((invD < 0 ? ax.max : ax.min) - orig) * invD;
+			auto t1 = ((invD < 0 ? ax.min : ax.max) - orig) * invD;
 			if (t0 > rT.min) rT.min = t0;
 			if (t1 < rT.max) rT.max = t1;
 			if (rT.max <= rT.min) // overlap interval doesn't exist
@@ -60,6 +74,12 @@ struct AxisAlignedBoundingBox {
 		}
 		return true;
 	}
+	// lanes of the packet in mask that enter the box before their tMax (see RayPacket::slabTest)
+	auto hitPacket(const RayPacket& packet, uint32_t mask, const Real* tMax) const -> uint32_t {
+		const Real lower[3] = { this->x.min, this->y.min, this->z.min };
+		const Real upper[3] = { this->x.max, this->y.max, this->z.max };
+		return packet.slabTest(lower, upper, mask, tMax);
+	}
 };
 
 auto operator+(const AxisAlignedBoundingBox& bbox, const Vec3& offset) -> AxisAlignedBoundingBox {
@@ -3,85 +3,725 @@
 #include "common.hpp"
 #include "Hittable.hpp"
 #include "HittableList.hpp"
+#include "ThreadPool.hpp"
+#include "SimdLanes.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <vector>
+
+/*
+	Knobs for building a BoundingVolumeHierarchy.
+	Costs are only meaningful relative to each other: the builder splits a set of objects when testing
+	two child boxes and then the objects the ray still reaches is expected to be cheaper than
+	intersecting every object of the set directly.
+*/
+struct BoundingVolumeHierarchyOptions {
+	int maxLeafSize = 4;			// sets larger than this are always split
+	int binCount = 16;				// candidate split planes tried per axis are binCount - 1 (at most 64 bins)
+	double traversalCost = 1.0;		// cost of testing one node's box
+	double intersectionCost = 1.0;	// cost of intersecting one object
+	unsigned int buildThreads = 0;	// 0 => one per hardware thread, 1 => build on the calling thread
+	size_t parallelGrain = 4096;	// sets smaller than this are never split across threads
+	bool printStats = false;		// print a summary of the finished tree (size, SAH cost, build time)
+};
 
 /*
 	By wrapping objects in a tree of bounding boxes, we can check ray hits
 	on bounding boxes, which excludes large portions of objects during ray collision tests.
 	It sort of reduced checks from about N to log N because of being a binary tree (b-tree, k=2).
-	The constructor for this organizes the hittables into the structure. Likely, this construction process
-	which is called every frame, can be heavily optimized to gain 2 effects:
-		- reduced construction time
-		- reduced hit checks during ray calculations
 	The construct used here is an Axis Aligned Bounding box, which is simply calculated
 	but possibly larger, and thus causes more ray checks during hit calculations.
+
+	Splits are chosen with the Surface Area Heuristic. The chance a ray passing through a node also passes
+	through a child is about the ratio of their surface areas, so the expected cost of a split is
+		traversalCost + intersectionCost * (area(left) * count(left) + area(right) * count(right)) / area(node)
+	Object centroids are dropped into binCount equal bins along each axis and every plane between
+	bins is costed in one sweep, the cheapest plane over all three axes wins. When no plane beats
+	intersecting the objects directly (and there are few enough of them) the node becomes a leaf.
+
+	The binary tree the splits make is then collapsed into a wide one: every node holds up to width
+	children (4 for double, 8 for float, one 256 bit register of either), pulled up from the binary tree
+	by repeatedly opening the largest box among them. A node's child boxes are stored axis by axis, lower
+	x of every child then lower y and so on, so a ray is tested against all of them with one SIMD slab test.
+	Leaves are not nodes of their own, a child slot either points at another node or holds a run of
+	up to maxLeafSize objects. Traversal is a loop over a stack of entered children still to visit, no
+	calls until a leaf. Children go on the stack far to near, by the distance the ray enters their box,
+	so the nearest is opened first, and anything popped that starts beyond the closest hit found since
+	it was pushed is dropped without a look.
+
+	Building works on one array of (box, centroid, object index) records, gathered with a single
+	boundingBox() call per object. Each split partitions its run of that array in place and recurses on
+	the two halves, so nothing is copied or re-sorted per level, and the finished order of the records is
+	the order the objects are stored in: every leaf's objects are one contiguous run.
+	The top of the tree is split on the calling thread until runs get small enough to hand out, those
+	subtrees are built side by side on a thread pool into their own node arrays and then spliced into
+	place behind their parents.
+
+	The tree only deals in primitive indices and boxes: whoever owns it stores the primitives in the order
+	build hands back and intersects a leaf's run of them when traversal reaches it (BoundingVolumeHierarchy
+	for Hittables, TriangleMesh for the triangles of a mesh).
 */
-class BoundingVolumeHierarchyNode : public Hittable {
-	shared_ptr<Hittable> left;
-	shared_ptr<Hittable> right;
+class BoundingVolumeHierarchyTree {
+public:
+	static constexpr int width = SimdLanes<Real>::width;
+
+private:
+	/*
+		Binary tree the builder makes, in depth first order: a node's first child directly follows it and
+		only the second child's index is stored. Bounds are floats rounded outward, so a node box is never
+		smaller than the boxes of what it holds.
+	*/
+	struct LinearNode {
+		float lower[3];
+		float upper[3];
+		uint32_t offset;	// leaf: first object index, interior: index of the second child
+		uint16_t count;		// objects in a leaf, 0 for interior nodes
+		uint8_t axis;		// split axis of interior nodes
+		uint8_t padding;
+	};
+	static_assert(sizeof(LinearNode) == 32, "BVH nodes are meant to pack two to a cache line");
+	/*
+		width children, boxes transposed for SIMD loads and kept as the binary tree's outward rounded floats:
+		128 bytes for a BVH4, 256 for a BVH8. Slots past childCount are empty boxes.
+	*/
+	struct WideNode {
+		alignas(32) float lower[3][width];
+		float upper[3][width];
+		uint32_t child[width];	// node index, or first object index of a leaf child
+		uint16_t count[width];	// objects in a leaf child, 0 for a node
+		uint32_t childCount;
+	};
+	// a child still to visit and where the ray enters its box
+	struct StackEntry {
+		Real tEntry;
+		uint32_t child;		// as WideNode::child
+		uint16_t count;		// as WideNode::count
+		uint16_t slot;		// which of its parent's children it is
+	};
+	static constexpr int maxDepth = 128;
+	static constexpr int forceMedianDepth = maxDepth / 2; // past this depth splits are halves, so no path is longer than maxDepth
+	static constexpr int stackSize = maxDepth * (width - 1) + 1; // every level leaves at most width - 1 children behind (plus the root)
+	static constexpr int maxBinCount = 64;
+
+	std::vector<WideNode> nodes;		// what build made, empty for a tree attached to nodes stored elsewhere
+	std::span<const WideNode> view;		// the nodes traversal walks, nodes or the attached ones
 	AxisAlignedBoundingBox bbox;
 
+	struct BuildPrimitive {
+		AxisAlignedBoundingBox box;
+		Point3 centroid;
+		uint32_t index;		// of the primitive
+	};
+	// a run of primitives left for a worker, built into its own array with node indices relative to it
+	struct BuildTask {
+		size_t start, end;
+		int depth;
+		std::vector<LinearNode> nodes;
+		size_t leaves = 0;
+	};
+	static constexpr uint8_t deferredAxis = 0xFF; // marks a placeholder node standing in for a BuildTask's subtree
+
 public:
-	BoundingVolumeHierarchyNode(const HittableList& list)
-		: BoundingVolumeHierarchyNode(list.objects, 0, list.objects.size()) {}
-	BoundingVolumeHierarchyNode(
-		const std::vector<shared_ptr<Hittable>>& srcObjects,
-		size_t start,
-		size_t end
-	) {
-		auto objects = srcObjects; // modifiable copy
+	BoundingVolumeHierarchyTree() {}
+	BoundingVolumeHierarchyTree(const BoundingVolumeHierarchyTree&) = delete; // a copy's view would still point at the original's nodes
+	auto operator=(const BoundingVolumeHierarchyTree&) -> BoundingVolumeHierarchyTree& = delete;
+
+	/*
+		Build over count primitives, boxOf(i) giving the box of primitive i. Returns the order to store the
+		primitives in: leaf runs index that order. what (ie "objects") and storageBytes, what the owner
+		spends on storing them, only go into the printed summary.
+	*/
+	auto build(
+		size_t count, const std::function<AxisAlignedBoundingBox(size_t)>& boxOf, const BoundingVolumeHierarchyOptions& options,
+		const char* what, size_t storageBytes
+	) -> std::vector<uint32_t> {
+		auto start = std::chrono::steady_clock::now();
+		auto threads = options.buildThreads != 0 ? options.buildThreads : std::max(std::thread::hardware_concurrency(), 1u);
+		if (count < 2 * options.parallelGrain) threads = 1; // not worth waking anyone up for
+		std::unique_ptr<ThreadPool> pool;
+		if (threads > 1) pool = std::make_unique<ThreadPool>(threads);
+
+		std::vector<BuildPrimitive> primitives(count);
+		auto gather = [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				auto box = boxOf(i);
+				primitives[i] = BuildPrimitive{ box, box.centroid(), static_cast<uint32_t>(i) };
+			}
+		};
+		if (pool) parallelFor(*pool, count, options.parallelGrain, gather);
+		else gather(0, count);
 
-		int axis = randomInt(0, 2);
-		size_t objectSpan = end - start;
+		size_t leaves = 0;
+		std::vector<LinearNode> binary;
+		if (count > 0) {
+			std::vector<BuildTask> tasks;
+			// runs this small or smaller become tasks, aiming for a few per thread so stealing can even them out
+			auto taskSize = pool ? std::max(options.parallelGrain, count / (4 * threads)) : count;
+			BoundingVolumeHierarchyTree::buildSubtree(primitives, 0, count, 0, options, binary, leaves, pool ? &tasks : nullptr, taskSize);
+			if (!tasks.empty()) {
+				parallelFor(*pool, tasks.size(), 1, [&](size_t begin, size_t end) {
+					for (size_t t = begin; t < end; t++) {
+						auto& task = tasks[t];
+						BoundingVolumeHierarchyTree::buildSubtree(primitives, task.start, task.end, task.depth, options, task.nodes, task.leaves, nullptr, 0);
+					}
+				});
+				leaves += BoundingVolumeHierarchyTree::splice(binary, tasks);
+			}
+			this->collapse(binary, 0);
+		}
+		this->view = this->nodes;
+		std::vector<uint32_t> order(count);
+		for (size_t i = 0; i < count; i++)
+			order[i] = primitives[i].index;
+		if (!binary.empty())
+			this->bbox = AxisAlignedBoundingBox(
+				Interval(binary[0].lower[0], binary[0].upper[0]),
+				Interval(binary[0].lower[1], binary[0].upper[1]),
+				Interval(binary[0].lower[2], binary[0].upper[2])
+			);
+		if (!options.printStats) return order;
+		auto buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		auto kib = [](size_t bytes) { return bytes / 1024.0; };
+		std::cout << "BVH" << width << ": " << count << ' ' << what << ", " << this->nodes.size() << " nodes (" << leaves
+			<< " leaves, collapsed from " << binary.size() << " binary nodes), SAH cost " << this->sahCost(options) << '\n'
+			<< "     built in " << buildTime << " ms on " << threads << (threads == 1 ? " thread, " : " threads, ")
+			<< kib(this->nodes.size() * sizeof(WideNode)) << " KiB nodes + " << kib(storageBytes) << " KiB " << what << " ("
+			<< kib(count * sizeof(BuildPrimitive) + binary.size() * sizeof(LinearNode)) << " KiB build scratch)\n";
+		return order;
+	}
 
-		if (objectSpan == 1) {
-			this->left = objects[start];
-			this->right = this->left;
+	/*
+		Walk the tree for r over rT, calling leafHit(first, count, rT) for every leaf run the ray reaches.
+		leafHit returns whether it found a hit, having pulled rT.max in to it.
+	*/
+	template <typename LeafHit>
+	auto hit(const Ray& r, Interval rT, LeafHit&& leafHit) const -> bool {
+		if (this->view.empty()) return false;
+		auto origin = r.origin();
+		auto direction = r.direction();
+		SimdLanes<Real> rayOrigin[3];
+		SimdLanes<Real> inverseDirection[3];
+		bool negative[3];
+		for (int a = 0; a < 3; a++) {
+			auto invD = 1 / direction[a];
+			rayOrigin[a] = SimdLanes<Real>(origin[a]);
+			inverseDirection[a] = SimdLanes<Real>(invD);
+			negative[a] = invD < 0;
+		}
+		StackEntry stack[stackSize];
+		int stackTop = 0;
+		stack[stackTop++] = StackEntry{ rT.min, 0, 0, 0 };
+		bool hitAnything = false;
+		while (stackTop > 0) {
+			auto entry = stack[--stackTop];
+			if (entry.tEntry >= rT.max) continue;
+			if (entry.count > 0) {
+				hitAnything |= leafHit(entry.child, static_cast<uint32_t>(entry.count), rT);
+				continue;
+			}
+			const auto& node = this->view[entry.child];
+			alignas(32) Real tEntry[width];
+			auto entered = BoundingVolumeHierarchyTree::childHits(node, rayOrigin, inverseDirection, negative, rT, tEntry);
+			stackTop = BoundingVolumeHierarchyTree::pushNearestLast(node, entered, tEntry, stack, stackTop);
 		}
-		else if (objectSpan == 2) {
-			if (BoundingVolumeHierarchyNode::boxCompare(objects[start], objects[start + 1], axis)) {
-				this->left = objects[start];
-				this->right = objects[start + 1];
+		return hitAnything;
+	}
+	/*
+		Whether anything blocks r within rT: leafOccluded(first, count, rT) for every leaf run the ray reaches
+		until one returns true. Any hit will do, so children go on the stack in slot order, without sorting,
+		and the walk ends at the first leaf that has one.
+	*/
+	template <typename LeafOccluded>
+	auto occluded(const Ray& r, Interval rT, LeafOccluded&& leafOccluded) const -> bool {
+		if (this->view.empty()) return false;
+		auto origin = r.origin();
+		auto direction = r.direction();
+		SimdLanes<Real> rayOrigin[3];
+		SimdLanes<Real> inverseDirection[3];
+		bool negative[3];
+		for (int a = 0; a < 3; a++) {
+			auto invD = 1 / direction[a];
+			rayOrigin[a] = SimdLanes<Real>(origin[a]);
+			inverseDirection[a] = SimdLanes<Real>(invD);
+			negative[a] = invD < 0;
+		}
+		StackEntry stack[stackSize];
+		int stackTop = 0;
+		stack[stackTop++] = StackEntry{ rT.min, 0, 0, 0 };
+		while (stackTop > 0) {
+			auto entry = stack[--stackTop];
+			if (entry.count > 0) {
+				if (leafOccluded(entry.child, static_cast<uint32_t>(entry.count), rT)) return true;
+				continue;
 			}
-			else {
-				this->left = objects[start + 1];
-				this->right = objects[start];
+			const auto& node = this->view[entry.child];
+			alignas(32) Real tEntry[width];
+			auto entered = BoundingVolumeHierarchyTree::childHits(node, rayOrigin, inverseDirection, negative, rT, tEntry);
+			for (; entered; entered &= entered - 1) {
+				auto c = std::countr_zero(entered);
+				stack[stackTop++] = StackEntry{ tEntry[c], node.child[c], node.count[c], static_cast<uint16_t>(c) };
 			}
 		}
-		else {
-			std::sort(objects.begin() + start, objects.begin() + end, [&axis](
-				const shared_ptr<Hittable> a,
-				const shared_ptr<Hittable> b
-			) -> bool {
-				return BoundingVolumeHierarchyNode::boxCompare(a, b, axis);
+		return false;
+	}
+	/*
+		Same walk as hit, once for the whole packet, carrying along only the lanes that entered each child's box,
+		leafHit(first, count, lanes) intersecting a leaf run for those lanes into hits.
+		Children are ordered by the nearest entry among their lanes and dropped once that is past every lane's closest hit.
+	*/
+	template <typename LeafHit>
+	auto hitPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits, LeafHit&& leafHit) const -> void {
+		if (this->view.empty()) return;
+		struct PacketEntry {
+			StackEntry entry;
+			uint32_t mask;
+		};
+		PacketEntry stack[stackSize];
+		int stackTop = 0;
+		stack[stackTop++] = PacketEntry{ StackEntry{ packet.tMin, 0, 0, 0 }, mask };
+		while (stackTop > 0) {
+			auto [entry, lanes] = stack[--stackTop];
+			Real farthestHit = packet.tMin;
+			for (auto m = lanes; m; m &= m - 1)
+				farthestHit = std::max(farthestHit, hits.tMax[std::countr_zero(m)]);
+			if (entry.tEntry >= farthestHit) continue;
+			if (entry.count > 0) {
+				leafHit(entry.child, static_cast<uint32_t>(entry.count), lanes);
+				continue;
+			}
+			const auto& node = this->view[entry.child];
+			alignas(32) Real tEntry[width];
+			uint32_t childLanes[width];
+			uint32_t entered = 0;
+			for (uint32_t c = 0; c < node.childCount; c++) {
+				const Real lower[3] = { node.lower[0][c], node.lower[1][c], node.lower[2][c] };
+				const Real upper[3] = { node.upper[0][c], node.upper[1][c], node.upper[2][c] };
+				alignas(32) Real laneEntry[RayPacket::width];
+				childLanes[c] = packet.slabTest(lower, upper, lanes, hits.tMax, laneEntry);
+				if (!childLanes[c]) continue;
+				entered |= 1u << c;
+				tEntry[c] = infinity;
+				for (auto m = childLanes[c]; m; m &= m - 1)
+					tEntry[c] = std::min(tEntry[c], laneEntry[std::countr_zero(m)]);
+			}
+			StackEntry ordered[width];
+			auto count = BoundingVolumeHierarchyTree::pushNearestLast(node, entered, tEntry, ordered, 0);
+			for (int k = 0; k < count; k++) {
+				auto c = ordered[k].slot;
+				stack[stackTop++] = PacketEntry{ ordered[k], childLanes[c] };
+			}
+		}
+	}
+	auto boundingBox() const -> AxisAlignedBoundingBox {
+		return this->bbox;
+	}
+	/*
+		Point every leaf somewhere else: a leaf child's first object index becomes remap(first, count).
+		For owners that don't keep a leaf's objects at its run of the build order (ie SphereSet, one SIMD
+		block per leaf). Only for a tree build made.
+	*/
+	template <typename Remap>
+	auto remapLeaves(Remap&& remap) -> void {
+		for (auto& node : this->nodes)
+			for (uint32_t c = 0; c < node.childCount; c++)
+				if (node.count[c] > 0) node.child[c] = remap(node.child[c], static_cast<uint32_t>(node.count[c]));
+	}
+	/*
+		The nodes as raw bytes, to store the tree (ie in a cache file) and attach it later instead of building
+		it again. Only meaningful to a build with the same node layout, nodeSize differs between BVH4 and BVH8.
+	*/
+	static constexpr size_t nodeSize = sizeof(WideNode);
+	auto nodeBytes() const -> std::span<const std::byte> {
+		return std::as_bytes(this->view);
+	}
+	/*
+		Walk count nodes at data, as nodeBytes gave them, bounded by box. Nothing is copied: data must be
+		aligned for the nodes (32 bytes) and stay where it is for as long as the tree is used.
+	*/
+	auto attach(const std::byte* data, size_t count, const AxisAlignedBoundingBox& box) -> void {
+		this->nodes.clear();
+		this->view = std::span(reinterpret_cast<const WideNode*>(data), count);
+		this->bbox = box;
+	}
+	/*
+		Whether the nodes are safe to walk over primitiveCount primitives, for attached nodes that came from
+		a file: every child count in range, every node pointing only further down the array (as build lays them
+		out, so there are no cycles) and no deeper than the traversal stack allows, and every leaf run within
+		the primitives.
+	*/
+	auto walkable(size_t primitiveCount) const -> bool {
+		std::vector<uint16_t> depth(this->view.size(), 0);
+		for (size_t i = 0; i < this->view.size(); i++) {
+			const auto& node = this->view[i];
+			if (node.childCount == 0 || node.childCount > width || depth[i] >= maxDepth) return false;
+			for (uint32_t c = 0; c < node.childCount; c++) {
+				if (node.count[c] > 0) {
+					if (static_cast<size_t>(node.child[c]) + node.count[c] > primitiveCount) return false;
+				}
+				else {
+					if (node.child[c] <= i || node.child[c] >= this->view.size()) return false;
+					depth[node.child[c]] = std::max<uint16_t>(depth[node.child[c]], depth[i] + 1);
+				}
+			}
+		}
+		return true;
+	}
+	/*
+		Expected cost of tracing a ray that hits the root box through this tree, in the units of the build options:
+		every node's SIMD test of its children (one traversal step) and every leaf's object tests, weighted by
+		the chance (area ratio) a ray reaches them. Lower is better, comparable between trees of the same objects.
+	*/
+	auto sahCost(const BoundingVolumeHierarchyOptions& options = {}) const -> double {
+		auto rootArea = static_cast<double>(this->bbox.surfaceArea());
+		if (this->view.empty() || rootArea <= 0) return 0;
+		double cost = options.traversalCost * rootArea;
+		for (const auto& node : this->view) {
+			for (uint32_t c = 0; c < node.childCount; c++) {
+				double d[3];
+				for (int a = 0; a < 3; a++)
+					d[a] = static_cast<double>(node.upper[a][c]) - node.lower[a][c];
+				auto area = 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+				cost += (node.count[c] > 0 ? options.intersectionCost * node.count[c] : options.traversalCost) * area;
+			}
+		}
+		return cost / rootArea;
+	}
+
+private:
+	/*
+		Children of node whose boxes the ray enters within rT, one bit each. Same steps as
+		AxisAlignedBoundingBox::hit done for every child at once, with the reciprocal of the direction
+		worked out once per ray and, knowing its signs, the near and far planes picked up front
+		instead of swapping per box.
+	*/
+	static auto childHits(
+		const WideNode& node, const SimdLanes<Real> origin[3], const SimdLanes<Real> inverseDirection[3], const bool negative[3], Interval rT,
+		Real* tEntry
+	) -> uint32_t {
+		SimdLanes<Real> tNear(rT.min);
+		SimdLanes<Real> tFar(rT.max);
+		for (int a = 0; a < 3; a++) {
+			auto nearPlane = SimdLanes<Real>::loadFloats(negative[a] ? node.upper[a] : node.lower[a]);
+			auto farPlane = SimdLanes<Real>::loadFloats(negative[a] ? node.lower[a] : node.upper[a]);
+			tNear = max((nearPlane - origin[a]) * inverseDirection[a], tNear);
+			tFar = min((farPlane - origin[a]) * inverseDirection[a], tFar);
+		}
+		tNear.store(tEntry);
+		return greaterThan(tFar, tNear).bits() & ((1u << node.childCount) - 1);
+	}
+	/*
+		Push the entered children of node onto stack, farthest entry first, so the nearest is popped next.
+		Returns the new top. Insertion sort, there are at most width of them.
+	*/
+	static auto pushNearestLast(const WideNode& node, uint32_t entered, const Real* tEntry, StackEntry* stack, int stackTop) -> int {
+		auto bottom = stackTop;
+		for (; entered; entered &= entered - 1) {
+			auto c = std::countr_zero(entered);
+			auto entry = StackEntry{ tEntry[c], node.child[c], node.count[c], static_cast<uint16_t>(c) };
+			auto k = stackTop++;
+			for (; k > bottom && stack[k - 1].tEntry < entry.tEntry; k--)
+				stack[k] = stack[k - 1];
+			stack[k] = entry;
+		}
+		return stackTop;
+	}
+	static auto surfaceArea(const LinearNode& node) -> double {
+		double d[3];
+		for (int a = 0; a < 3; a++)
+			d[a] = static_cast<double>(node.upper[a]) - node.lower[a];
+		return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+	}
+	static auto roundDown(Real value) -> float {
+		auto f = static_cast<float>(value);
+		return f > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+	}
+	static auto roundUp(Real value) -> float {
+		auto f = static_cast<float>(value);
+		return f < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+	}
+
+	/*
+		Box unions for the builder. Bounding boxes hold no NaNs, so plain comparisons do, and they
+		compile to single instructions where the fmin/fmax of Interval's union are library calls.
+	*/
+	static auto grow(Interval& ival, Real min, Real max) -> void {
+		ival.min = std::min(ival.min, min);
+		ival.max = std::max(ival.max, max);
+	}
+	static auto grow(AxisAlignedBoundingBox& box, const AxisAlignedBoundingBox& other) -> void {
+		BoundingVolumeHierarchyTree::grow(box.x, other.x.min, other.x.max);
+		BoundingVolumeHierarchyTree::grow(box.y, other.y.min, other.y.max);
+		BoundingVolumeHierarchyTree::grow(box.z, other.z.min, other.z.max);
+	}
+	static auto grow(AxisAlignedBoundingBox& box, const Point3& p) -> void {
+		BoundingVolumeHierarchyTree::grow(box.x, p.x(), p.x());
+		BoundingVolumeHierarchyTree::grow(box.y, p.y(), p.y());
+		BoundingVolumeHierarchyTree::grow(box.z, p.z(), p.z());
+	}
+
+	/*
+		Build the subtree over primitives [start, end) onto the end of nodes, depth first, partitioning the
+		primitives in place. Returns the index of the subtree's root.
+		With tasks given, runs of at most taskSize primitives are not built: they get a placeholder node and
+		are queued as tasks instead (the subtree under a placeholder is contiguous in the finished array,
+		so it can be dropped in later).
+	*/
+	static auto buildSubtree(
+		std::vector<BuildPrimitive>& primitives, size_t start, size_t end, int depth, const BoundingVolumeHierarchyOptions& options,
+		std::vector<LinearNode>& nodes, size_t& leaves, std::vector<BuildTask>* tasks, size_t taskSize
+	) -> uint32_t {
+		auto index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(LinearNode{});
+		AxisAlignedBoundingBox box;
+		AxisAlignedBoundingBox centroidBounds;
+		for (size_t i = start; i < end; i++) {
+			BoundingVolumeHierarchyTree::grow(box, primitives[i].box);
+			BoundingVolumeHierarchyTree::grow(centroidBounds, primitives[i].centroid);
+		}
+		for (int a = 0; a < 3; a++) {
+			nodes[index].lower[a] = BoundingVolumeHierarchyTree::roundDown(box.axis(a).min);
+			nodes[index].upper[a] = BoundingVolumeHierarchyTree::roundUp(box.axis(a).max);
+		}
+		auto count = end - start;
+		if (tasks && count <= taskSize) {
+			nodes[index].offset = static_cast<uint32_t>(tasks->size());
+			nodes[index].axis = deferredAxis;
+			tasks->push_back(BuildTask{ start, end, depth, {} });
+			return index;
+		}
+		auto makeLeaf = [&]() {
+			leaves++;
+			nodes[index].offset = static_cast<uint32_t>(start);
+			nodes[index].count = static_cast<uint16_t>(count);
+			return index;
+		};
+		if (count == 1) return makeLeaf();
+
+		int bestAxis = -1;
+		int bestPlane = 0;
+		auto bestCost = infinity;
+		auto binCount = std::clamp(options.binCount, 2, maxBinCount);
+		auto binOf = [&](const BuildPrimitive& primitive, int axis) {
+			const auto& extent = centroidBounds.axis(axis);
+			auto bin = static_cast<int>(binCount * ((primitive.centroid[axis] - extent.min) / extent.size()));
+			return std::clamp(bin, 0, binCount - 1);
+		};
+		struct Bin {
+			AxisAlignedBoundingBox box;
+			size_t count = 0;
+		};
+		Bin bins[maxBinCount];
+		Real rightArea[maxBinCount];
+		size_t rightCount[maxBinCount];
+		for (int axis = 0; axis < 3 && depth < forceMedianDepth; axis++) {
+			if (centroidBounds.axis(axis).size() <= 0) continue; // all centroids on one plane, nothing to split along
+			std::fill(bins, bins + binCount, Bin{});
+			for (size_t i = start; i < end; i++) {
+				auto& bin = bins[binOf(primitives[i], axis)];
+				BoundingVolumeHierarchyTree::grow(bin.box, primitives[i].box);
+				bin.count++;
+			}
+			// sweep from the right to know what lies past every plane, then from the left costing each one
+			AxisAlignedBoundingBox accumulated;
+			size_t accumulatedCount = 0;
+			for (int b = binCount - 1; b > 0; b--) {
+				BoundingVolumeHierarchyTree::grow(accumulated, bins[b].box);
+				accumulatedCount += bins[b].count;
+				rightArea[b] = accumulated.surfaceArea();
+				rightCount[b] = accumulatedCount;
+			}
+			accumulated = AxisAlignedBoundingBox();
+			accumulatedCount = 0;
+			for (int plane = 1; plane < binCount; plane++) { // plane p puts bins [0, p) on the left
+				BoundingVolumeHierarchyTree::grow(accumulated, bins[plane - 1].box);
+				accumulatedCount += bins[plane - 1].count;
+				if (accumulatedCount == 0 || rightCount[plane] == 0) continue;
+				auto cost = accumulated.surfaceArea() * accumulatedCount + rightArea[plane] * rightCount[plane];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestPlane = plane;
+				}
+			}
+		}
+		auto nodeArea = static_cast<double>(box.surfaceArea());
+		auto splitCost = options.traversalCost + options.intersectionCost * (nodeArea > 0 ? bestCost / nodeArea : 0);
+		auto leafCost = options.intersectionCost * count;
+		if (count <= static_cast<size_t>(std::clamp(options.maxLeafSize, 1, 65535)) && (bestAxis < 0 || leafCost <= splitCost))
+			return makeLeaf();
+
+		auto first = primitives.begin() + start;
+		auto last = primitives.begin() + end;
+		size_t mid;
+		int splitAxis;
+		if (bestAxis >= 0) {
+			splitAxis = bestAxis;
+			mid = std::partition(first, last, [&](const BuildPrimitive& primitive) {
+				return binOf(primitive, bestAxis) < bestPlane;
+			}) - primitives.begin();
+		}
+		else { // deep in the tree, or every centroid in one spot: halve the set along the widest centroid spread
+			splitAxis = 0;
+			for (int a = 1; a < 3; a++)
+				if (centroidBounds.axis(a).size() > centroidBounds.axis(splitAxis).size()) splitAxis = a;
+			mid = start + count / 2;
+			std::nth_element(first, primitives.begin() + mid, last, [splitAxis](const BuildPrimitive& a, const BuildPrimitive& b) {
+				return a.centroid[splitAxis] < b.centroid[splitAxis];
 			});
-			auto mid = start + objectSpan / 2;
-			this->left = make_shared<BoundingVolumeHierarchyNode>(objects, start, mid);
-			this->right = make_shared<BoundingVolumeHierarchyNode>(objects, mid, end);
 		}
-		this->bbox = AxisAlignedBoundingBox(this->left->boundingBox(), this->right->boundingBox());
+
+		BoundingVolumeHierarchyTree::buildSubtree(primitives, start, mid, depth + 1, options, nodes, leaves, tasks, taskSize); // first child lands right after this node
+		auto second = BoundingVolumeHierarchyTree::buildSubtree(primitives, mid, end, depth + 1, options, nodes, leaves, tasks, taskSize);
+		nodes[index].offset = second;
+		nodes[index].axis = static_cast<uint8_t>(splitAxis);
+		return index;
+	}
+	/*
+		Swap every placeholder in nodes for the subtree its task built, keeping depth first order, and
+		move the second child indices of the nodes above to where things ended up. Returns the leaves added.
+	*/
+	static auto splice(std::vector<LinearNode>& nodes, std::vector<BuildTask>& tasks) -> size_t {
+		std::vector<LinearNode> top;
+		top.swap(nodes);
+		std::vector<uint32_t> moved(top.size());	// top node index -> index in the finished array
+		size_t total = top.size();
+		for (const auto& task : tasks) total += task.nodes.size() - 1;
+		nodes.reserve(total);
+		size_t leaves = 0;
+		for (size_t i = 0; i < top.size(); i++) {
+			auto base = static_cast<uint32_t>(nodes.size());
+			moved[i] = base;
+			if (top[i].count > 0 || top[i].axis != deferredAxis) {
+				nodes.push_back(top[i]);
+				continue;
+			}
+			const auto& task = tasks[top[i].offset];
+			leaves += task.leaves;
+			for (auto node : task.nodes) {
+				if (node.count == 0) node.offset += base;
+				nodes.push_back(node);
+			}
+		}
+		for (size_t i = 0; i < top.size(); i++) {
+			auto& node = nodes[moved[i]];
+			if (top[i].count == 0 && top[i].axis != deferredAxis) node.offset = moved[node.offset];
+		}
+		return leaves;
 	}
+	/*
+		Turn the binary subtree under binary[index] into wide nodes, depth first, and return the index of its
+		top node. The children start out as the binary node's two, then the one with the largest box that
+		isn't a leaf is replaced by its own two until there are width of them (or only leaves left).
+	*/
+	auto collapse(const std::vector<LinearNode>& binary, uint32_t index) -> uint32_t {
+		uint32_t children[width];
+		int childCount = 0;
+		if (binary[index].count > 0) children[childCount++] = index; // a lone leaf at the root
+		else {
+			children[childCount++] = index + 1;
+			children[childCount++] = binary[index].offset;
+		}
+		while (childCount < width) {
+			int largest = -1;
+			double largestArea = -1;
+			for (int c = 0; c < childCount; c++) {
+				const auto& node = binary[children[c]];
+				if (node.count > 0) continue;
+				auto area = BoundingVolumeHierarchyTree::surfaceArea(node);
+				if (area > largestArea) {
+					largest = c;
+					largestArea = area;
+				}
+			}
+			if (largest < 0) break;
+			auto opened = children[largest];
+			children[largest] = opened + 1;
+			children[childCount++] = binary[opened].offset;
+		}
+
+		auto wideIndex = static_cast<uint32_t>(this->nodes.size());
+		this->nodes.push_back(WideNode{});
+		uint32_t childIndex[width];
+		for (int c = 0; c < childCount; c++) {
+			const auto& node = binary[children[c]];
+			childIndex[c] = node.count > 0 ? node.offset : this->collapse(binary, children[c]);
+		}
+		auto& wide = this->nodes[wideIndex]; // only now, collapsing the children grows nodes
+		wide.childCount = static_cast<uint32_t>(childCount);
+		for (int c = 0; c < width; c++) {
+			for (int a = 0; a < 3; a++) {
+				wide.lower[a][c] = c < childCount ? binary[children[c]].lower[a] : std::numeric_limits<float>::infinity();
+				wide.upper[a][c] = c < childCount ? binary[children[c]].upper[a] : -std::numeric_limits<float>::infinity();
+			}
+			wide.child[c] = c < childCount ? childIndex[c] : 0;
+			wide.count[c] = c < childCount ? binary[children[c]].count : 0;
+		}
+		return wideIndex;
+	}
+};
 
-	auto hit(const Ray& r, Interval rT, HitRecord& rec) const -> bool override {
-		if (!this->bbox.hit(r, rT)) return false;
-		bool hitLeft = this->left->hit(r, rT, rec);
-		bool hitRight = this->right->hit(
-			r,
-			Interval(rT.min, hitLeft ? rec.t : rT.max),
-			rec
+/*
+	Hittable over a set of objects: a BoundingVolumeHierarchyTree of their boxes with the objects stored
+	in its leaf order.
+*/
+class BoundingVolumeHierarchy : public Hittable {
+	BoundingVolumeHierarchyTree tree;
+	std::vector<shared_ptr<Hittable>> objects;	// in leaf order
+
+public:
+	BoundingVolumeHierarchy(const HittableList& list, const BoundingVolumeHierarchyOptions& options = {})
+		: BoundingVolumeHierarchy(list.objects, options) {}
+	BoundingVolumeHierarchy(const std::vector<shared_ptr<Hittable>>& srcObjects, const BoundingVolumeHierarchyOptions& options = {}) {
+		auto order = this->tree.build(
+			srcObjects.size(), [&](size_t i) { return srcObjects[i]->boundingBox(); }, options,
+			"objects", srcObjects.size() * sizeof(shared_ptr<Hittable>)
 		);
-		return hitLeft || hitRight;
+		this->objects.reserve(order.size());
+		for (auto index : order)
+			this->objects.push_back(srcObjects[index]);
+	}
+
+	auto intersect(const Ray& r, Interval rT, HitRecord& rec) const -> bool override {
+		return this->tree.hit(r, rT, [&](uint32_t first, uint32_t count, Interval& leafT) {
+			bool hitAnything = false;
+			for (uint32_t i = first; i < first + count; i++) {
+				if (this->objects[i]->intersect(r, leafT, rec)) {
+					hitAnything = true;
+					leafT.max = rec.t;
+				}
+			}
+			return hitAnything;
+		});
+	}
+	auto occluded(const Ray& r, Interval rT) const -> bool override {
+		return this->tree.occluded(r, rT, [&](uint32_t first, uint32_t count, const Interval& leafT) {
+			for (uint32_t i = first; i < first + count; i++)
+				if (this->objects[i]->occluded(r, leafT)) return true;
+			return false;
+		});
+	}
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		for (const auto& object : this->objects)
+			object->gatherLights(lights, path);
+	}
+	auto intersectPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void override {
+		this->tree.hitPacket(packet, mask, hits, [&](uint32_t first, uint32_t count, uint32_t lanes) {
+			for (uint32_t i = first; i < first + count; i++)
+				this->objects[i]->intersectPacket(packet, lanes, hits);
+		});
 	}
 	auto boundingBox() const -> AxisAlignedBoundingBox override {
-		return this->bbox;
+		return this->tree.boundingBox();
 	}
-
-private:
-	static auto boxCompare(
-		const shared_ptr<Hittable> a,
-		const shared_ptr<Hittable> b,
-		int axisIndex
-	) -> bool {
-		return a->boundingBox().axis(axisIndex).min < b->boundingBox().axis(axisIndex).min;
+	auto sahCost(const BoundingVolumeHierarchyOptions& options = {}) const -> double {
+		return this->tree.sahCost(options);
 	}
 };
@@ -2,9 +2,18 @@
 
 #include "common.hpp"
 #include "Material.hpp"
+#include "LightList.hpp"
 #include "ThreadPool.hpp"
+#include "Framebuffer.hpp"
+#include "ImageWriter.hpp"
+#include "AccumulationBuffer.hpp"
 
-#include <fstream>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
 
 class Camera {
 	int imageHeight;			// rendered image height
@@ -17,11 +26,47 @@ class Camera {
 	Vec3 defocusDiskV;			// Defocus disk vertical radius
 	int sqrtSamplesPerPixel;	// sqrt of samplesPerPixel
 	double reciprocalSqrtSPP;	// reciprocal of sqrt of samplesPerPixel
+	int stratumStride;			// step between the strata of consecutive samples, coprime with samplesPerPixel
+
+	struct Tile {				// [x0, x1) x [y0, y1) block of pixels rendered as one task
+		int x0, y0, x1, y1;
+	};
+	LightList lights;			// Lights of the world being rendered, when sampleLights
+	// the path vertex a ray left from, as light sampling there saw it (see shade)
+	struct Bounce {
+		Real pdf = 0;			// of the ray's direction, 0 when light sampling could not have picked a light the ray hits instead
+		Point3 from;			// where light sampling picked for, and the normal it picked with
+		Vec3 normal;
+	};
 public:
 	double aspectRatio = 1.0;	// Ratio of image width over height
 	int imageWidth = 100;		// Rendered image width in pixel count
 	int samplePerPixel = 10;	// Count of random samples for each pixel
 	int maxDepth = 10;			// Maximum number of ray bounces into scene
+	int rouletteStartDepth = 3;	// Bounces before russian roulette may end a path (>= maxDepth turns it off)
+	double rouletteMaxSurvival = 0.95;	// Upper bound on the chance a path survives a roulette step
+	int tileSize = 16;			// Width and height of the square pixel tiles handed to render threads
+	unsigned int threadCount = std::thread::hardware_concurrency(); // Render threads kept alive for the whole frame
+	uint32_t seed = 0;			// Mixed into every sample's random stream, change to get a different noise pattern
+	std::string outputPath = "out/image.ppm";	// Where the finished frame is written
+	shared_ptr<ImageWriter> imageWriter;		// Output format, picked from the outputPath extension when not set
+	bool adaptiveSampling = false;	// Render in passes and stop sampling pixels once they have converged
+	int samplesPerPass = 16;		// Samples added to every active pixel per pass when rendering progressively (adaptive or checkpointed)
+	int adaptiveMinSamples = 32;	// Samples a pixel takes before its noise estimate is trusted
+	double adaptiveThreshold = 0.004;	// Converged once the displayed (gamma corrected) luminance is this certain, ~1/255
+	std::string checkpointPath;		// When set, the accumulated samples are saved here every checkpointInterval and at the end
+	double checkpointInterval = 300;	// Seconds between checkpoints
+	bool resumeFromCheckpoint = false;	// Continue adding samples to the render saved at checkpointPath
+	int tileRangeBegin = 0;			// Render only tiles [tileRangeBegin, tileRangeEnd) of the Morton ordered tile list
+	int tileRangeEnd = -1;			// (-1 => through the last tile), so several processes can split one frame by area
+	int sampleRangeBegin = 0;		// Take only samples [sampleRangeBegin, sampleRangeEnd) of every pixel
+	int sampleRangeEnd = -1;		// (-1 => through the last sample), so several processes can split one frame by samples
+	std::string partialPath;		// When set, the raw accumulation is written here for RaytracerMerge instead of an image
+	bool wavefront = false;			// Trace each tile as batches of paths, one bounce at a time, shading hits grouped by material
+	int wavefrontBatchSize = 8192;	// Paths in flight per batch in wavefront mode
+	bool packetPrimaryRays = true;	// Intersect camera rays in SIMD packets (one BVH walk per packet), bounces stay single rays
+	bool sampleLights = true;	// Aim a shadow ray at a point on the scene's lights from every diffuse bounce (next event estimation)
+	bool lightTree = true;		// Pick the light to aim at by its likely contribution (LightTree), rather than uniformly
 	Color background;			// Default color without emitted coloring
 	
 	double vfov = 90; // Vertical view angle (field of view)
@@ -41,44 +86,96 @@ public:
 		Camera fires rays from random points on the lens through the current image sample location
 	*/
 
-	auto render(const Hittable& world) -> void {
+	// false (after printing why) when the result couldn't be written
+	auto render(const Hittable& world) -> bool {
+		MaterialTable::Frozen frozenMaterials(sceneMaterials);
 		this->initialize();
-		std::ofstream outImage;
-		outImage.open("out/image.ppm", std::ios::out | std::ios::trunc);
-		outImage << "P3\n" << this->imageWidth << ' ' << this->imageHeight << "\n255\n";
-		std::vector<Color> colorBuffer(this->imageWidth, Color(0,0,0));
-		ThreadPool* threadPool;
-		this->sqrtSamplesPerPixel = static_cast<int>(sqrt(this->samplePerPixel));
-		this->reciprocalSqrtSPP = 1.0 / static_cast<double>(this->sqrtSamplesPerPixel);
-		for (int j = 0; j < this->imageHeight; j++) {
-			threadPool = new ThreadPool(8);
-			std::cout << "\rScalines remaining: " << (this->imageHeight - j) << ' ' << std::flush;
-			for (int i = 0; i < this->imageWidth; i++) {
-				threadPool->queueTask([this, i, j, &colorBuffer, &world]() {
-					Color pixelColor(0, 0, 0);
-					for (int sJ = 0; sJ < this->sqrtSamplesPerPixel; sJ++) { // split rays being cast in to stratified set rather than random
-						for (int sI = 0; sI < this->sqrtSamplesPerPixel; sI++) {	// to improve monte carlo estimation of pixel color
-							Ray r = getRay(i, j, sI, sJ);
-							pixelColor += rayColor(r, this->maxDepth, world);
-						}
-					}
-					colorBuffer[i] = pixelColor;
+		this->lights = LightList();
+		if (this->sampleLights) {
+			this->lights.gather(world, this->lightTree);
+			std::cout << "Sampling " << this->lights.size() << (this->lights.size() == 1 ? " light" : " lights");
+			if (this->lights.treeNodes() > 0) std::cout << " (light tree, " << this->lights.treeNodes() << " nodes)";
+			std::cout << '\n';
+		}
+		AccumulationBuffer accumulation(this->imageWidth, this->imageHeight);
+		auto strata = this->sqrtSamplesPerPixel * this->sqrtSamplesPerPixel;
+		auto firstSample = std::clamp(this->sampleRangeBegin, 0, strata);
+		auto totalSamples = this->sampleRangeEnd < 0 ? strata : std::clamp(this->sampleRangeEnd, firstSample, strata);
+
+		// only the requested run of the tile curve is rendered, everything else stays at 0 samples
+		auto tiles = this->mortonOrderedTiles();
+		auto firstTile = std::clamp(this->tileRangeBegin, 0, static_cast<int>(tiles.size()));
+		auto lastTile = this->tileRangeEnd < 0 ? static_cast<int>(tiles.size()) : std::clamp(this->tileRangeEnd, firstTile, static_cast<int>(tiles.size()));
+		tiles = std::vector<Tile>(tiles.begin() + firstTile, tiles.begin() + lastTile);
+		std::fill(accumulation.active.begin(), accumulation.active.end(), 0);
+		for (const auto& tile : tiles)
+			for (int j = tile.y0; j < tile.y1; j++)
+				std::fill_n(accumulation.active.begin() + (static_cast<size_t>(j) * this->imageWidth + tile.x0), tile.x1 - tile.x0, 1);
+
+		auto heldFrom = firstSample; // the first sample index the sums hold, earlier when resuming a checkpoint
+		auto samplesDone = this->resumeFromCheckpoint ? this->loadCheckpoint(accumulation, heldFrom) : 0;
+		auto checkpointing = !this->checkpointPath.empty();
+		auto passSize = this->adaptiveSampling || checkpointing ? std::max(this->samplesPerPass, 1) : std::max(totalSamples - firstSample, 1);
+		auto lastCheckpoint = std::chrono::steady_clock::now();
+		std::mutex progressMutex;
+		ThreadPool threadPool(this->threadCount);
+		auto passEnd = std::max(samplesDone, firstSample);
+		for (int passStart = passEnd; passStart < totalSamples; passStart += passSize) {
+			passEnd = std::min(passStart + passSize, totalSamples);
+			std::atomic<size_t> tilesRemaining(tiles.size());
+			// hand each worker a contiguous run of the curve so neighbouring tiles share a core (and its cache),
+			// idle workers steal from the far end of someone else's run
+			auto tilesPerWorker = (tiles.size() + threadPool.size() - 1) / threadPool.size();
+			for (size_t t = 0; t < tiles.size(); t++) {
+				threadPool.queueTask(static_cast<unsigned int>(t / tilesPerWorker), [&, t, passStart, passEnd]() {
+					if (this->wavefront)
+						this->renderTileWavefront(tiles[t], world, accumulation, passStart, passEnd);
+					else
+						this->renderTile(tiles[t], world, accumulation, passStart, passEnd);
+					auto remaining = --tilesRemaining;
+					std::unique_lock<std::mutex> lock(progressMutex);
+					std::cout << "\rSamples " << passEnd << '/' << totalSamples << ", tiles remaining: " << remaining << ' ' << std::flush;
 				});
-				//Color pixelColor(0, 0, 0);
-				//for (int sample = 0; sample < this->samplePerPixel; sample++) {
-				//	Ray r = getRay(i, j);
-				//	pixelColor += rayColor(r, this->maxDepth, world);
-				//}
-				//writeColor(outImage, pixelColor, this->samplePerPixel);
 			}
-			while (threadPool->busy())
-				std::this_thread::yield();
-			delete threadPool;
-			for (int i = 0; i < this->imageWidth; i++)
-				writeColor(outImage, colorBuffer[i], this->samplePerPixel);
+			threadPool.wait();
+
+			size_t stillActive = tiles.size();
+			if (this->adaptiveSampling && passEnd - firstSample >= this->adaptiveMinSamples) {
+				stillActive = 0;
+				for (size_t p = 0; p < accumulation.size(); p++) {
+					if (accumulation.active[p] && accumulation.displayError(p) <= this->adaptiveThreshold)
+						accumulation.active[p] = 0;
+					stillActive += accumulation.active[p];
+				}
+				std::cout << "\rSamples " << passEnd << '/' << totalSamples << ", pixels still sampling: " << stillActive << "          \n" << std::flush;
+			}
+			auto finished = stillActive == 0 || passEnd == totalSamples;
+			auto now = std::chrono::steady_clock::now();
+			if (checkpointing && (finished || std::chrono::duration<double>(now - lastCheckpoint).count() >= this->checkpointInterval)) {
+				AccumulationInfo info{
+					this->seed, static_cast<uint32_t>(passEnd), static_cast<uint32_t>(strata),
+					static_cast<uint32_t>(heldFrom), static_cast<uint32_t>(passEnd)
+				};
+				if (accumulation.save(this->checkpointPath, info))
+					std::cout << "\rCheckpoint saved at " << passEnd << " samples          \n" << std::flush;
+				lastCheckpoint = now;
+			}
+			if (finished) break;
+		}
+
+		if (!this->partialPath.empty()) {
+			AccumulationInfo info{
+				this->seed, static_cast<uint32_t>(passEnd), static_cast<uint32_t>(strata),
+				static_cast<uint32_t>(heldFrom), static_cast<uint32_t>(passEnd)
+			};
+			if (!accumulation.save(this->partialPath, info)) return false; // a stale partial from an earlier run may still be there
+			std::cout << "\nPartial accumulation written to " << this->partialPath << ".\n";
+			return true;
 		}
-		outImage.close();
+		auto writer = this->imageWriter ? this->imageWriter : imageWriterFor(this->outputPath);
+		if (!writer->write(accumulation.resolve(), this->outputPath, threadPool)) return false;
 		std::cout << "\nDone.\n";
+		return true;
 	}
 private:
 	auto initialize() -> void {
@@ -125,45 +222,330 @@ private:
 		auto defocusRadius = this->focusDistance * tan(degreesToRadians(this->defocusAngle / 2));
 		this->defocusDiskU = this->u * defocusRadius;
 		this->defocusDiskV = this->v * defocusRadius;
+
+		// Stratification of the samples within each pixel.
+		this->sqrtSamplesPerPixel = std::max(static_cast<int>(sqrt(this->samplePerPixel)), 1);
+		this->reciprocalSqrtSPP = 1.0 / static_cast<double>(this->sqrtSamplesPerPixel);
+		auto strata = this->sqrtSamplesPerPixel * this->sqrtSamplesPerPixel;
+		this->stratumStride = std::max(static_cast<int>(strata * 0.6180339887), 1); // golden ratio step
+		while (std::gcd(this->stratumStride, strata) != 1)
+			this->stratumStride++;
+	}
+	/*
+		Pick up a render saved by an earlier (possibly killed) run. Returns the sample it got up to and sets
+		heldFrom to the one it started at, or returns 0 and leaves the buffer empty if there is nothing usable to resume.
+		The sample range may end later than the saved run's, which adds more samples to a finished render, but
+		samplesPerPixel has to match: the stratum stride is worked out from it, so with another the remaining
+		samples wouldn't continue the same sequence.
+	*/
+	auto loadCheckpoint(AccumulationBuffer& accumulation, int& heldFrom) const -> int {
+		AccumulationInfo info;
+		AccumulationBuffer saved(0, 0);
+		if (this->checkpointPath.empty() || !AccumulationBuffer::load(this->checkpointPath, saved, info)) {
+			std::cout << "No checkpoint to resume from, starting fresh.\n";
+			return 0;
+		}
+		if (saved.width != this->imageWidth || saved.height != this->imageHeight || info.seed != this->seed) {
+			std::cerr << "ERROR: Checkpoint '" << this->checkpointPath << "' was rendered with different image settings, starting fresh.\n";
+			return 0;
+		}
+		if (info.sampleTarget != static_cast<uint32_t>(this->sqrtSamplesPerPixel * this->sqrtSamplesPerPixel)) {
+			std::cerr << "ERROR: Checkpoint '" << this->checkpointPath << "' was rendered with a different samples per pixel, starting fresh.\n";
+			return 0;
+		}
+		accumulation = std::move(saved);
+		heldFrom = static_cast<int>(info.sampleBegin);
+		std::cout << "Resuming from " << info.samplesCompleted << " samples per pixel.\n";
+		return static_cast<int>(info.samplesCompleted);
+	}
+	/*
+		Take samples [sampleBegin, sampleEnd) for every still active pixel of the tile.
+		Sample s lands in stratum (s * stratumStride) mod n of the pixel's sqrt(n) x sqrt(n) grid. The stride
+		is coprime with n, so a full run covers every stratum once, and a run cut short by adaptive sampling
+		is still spread out over the pixel rather than bunched into its first rows.
+		With packetPrimaryRays, a pixel's camera rays are generated RayPacket::width at a time and their
+		first hits found together. Every lane keeps its own Sampler, so the image does not change.
+	*/
+	auto renderTile(const Tile& tile, const Hittable& world, AccumulationBuffer& accumulation, int sampleBegin, int sampleEnd) const -> void {
+		auto strata = this->sqrtSamplesPerPixel * this->sqrtSamplesPerPixel;
+		auto lanes = this->packetPrimaryRays ? RayPacket::width : 1;
+		Sampler samplers[RayPacket::width];
+		Ray rays[RayPacket::width];
+		for (int j = tile.y0; j < tile.y1; j++) {
+			for (int i = tile.x0; i < tile.x1; i++) {
+				auto pixelIndex = static_cast<uint32_t>(j * this->imageWidth + i);
+				if (!accumulation.active[pixelIndex]) continue;
+				for (int s = sampleBegin; s < sampleEnd; s += lanes) { // split rays being cast in to stratified set rather than random
+					auto count = std::min(lanes, sampleEnd - s);
+					for (int lane = 0; lane < count; lane++) {
+						auto stratum = static_cast<int>((static_cast<int64_t>(s + lane) * this->stratumStride) % strata); // to improve monte carlo estimation of pixel color
+						samplers[lane] = Sampler(pixelIndex, static_cast<uint32_t>(s + lane), this->seed);
+						rays[lane] = getRay(i, j, stratum % this->sqrtSamplesPerPixel, stratum / this->sqrtSamplesPerPixel, samplers[lane]);
+					}
+					if (!this->packetPrimaryRays) {
+						accumulation.addSample(pixelIndex, rayColor(rays[0], world, samplers[0]));
+						continue;
+					}
+					RayPacket packet(rays, count, 0);
+					PacketHitRecord hits(infinity);
+					if (this->maxDepth > 0)
+						world.hitPacket(packet, packet.activeMask(), hits);
+					for (int lane = 0; lane < count; lane++)
+						accumulation.addSample(pixelIndex, continuePath(rays[lane], (hits.hitMask >> lane) & 1, hits.records[lane], world, samplers[lane]));
+				}
+			}
+		}
+	}
+	/*
+		Same samples as renderTile, traced breadth first. A batch of camera paths is intersected against
+		the scene together, the hits are bucketed by material kind and every bucket is shaded in one run,
+		then finished paths are dropped and the survivors go around again for their next bounce.
+		Each path keeps its own Sampler and draws from it in the same order rayColor does, and finished
+		colors are added to the accumulation in the same (pixel, sample) order, so the image is bit-identical
+		to the depth first mode.
+	*/
+	auto renderTileWavefront(const Tile& tile, const Hittable& world, AccumulationBuffer& accumulation, int sampleBegin, int sampleEnd) const -> void {
+		struct PathState {
+			Ray ray;
+			Color throughput;
+			Color radiance;
+			Bounce bounce;		// as in continuePath
+			Sampler sampler;
+			uint32_t slot;		// index of the path's (pixel, sample) within the batch
+		};
+		auto strata = this->sqrtSamplesPerPixel * this->sqrtSamplesPerPixel;
+		std::vector<std::pair<uint32_t, int>> work; // (pixel, sample) in the order renderTile takes them
+		for (int j = tile.y0; j < tile.y1; j++)
+			for (int i = tile.x0; i < tile.x1; i++) {
+				auto pixelIndex = static_cast<uint32_t>(j * this->imageWidth + i);
+				if (!accumulation.active[pixelIndex]) continue;
+				for (int s = sampleBegin; s < sampleEnd; s++)
+					work.push_back({ pixelIndex, s });
+			}
+
+		auto batchSize = static_cast<size_t>(std::max(this->wavefrontBatchSize, 1));
+		std::vector<PathState> paths;
+		std::vector<Color> results;
+		std::vector<HitRecord> records;
+		std::vector<uint8_t> alive;
+		std::vector<uint32_t> order;
+		for (size_t batchStart = 0; batchStart < work.size(); batchStart += batchSize) {
+			auto batchEnd = std::min(batchStart + batchSize, work.size());
+			paths.clear();
+			paths.reserve(batchEnd - batchStart); // never reallocates while filling, rays point at their path's sampler
+			results.assign(batchEnd - batchStart, Color(0, 0, 0));
+			for (auto k = batchStart; k < batchEnd; k++) {
+				auto [pixelIndex, s] = work[k];
+				auto stratum = static_cast<int>((static_cast<int64_t>(s) * this->stratumStride) % strata);
+				auto i = static_cast<int>(pixelIndex % this->imageWidth);
+				auto j = static_cast<int>(pixelIndex / this->imageWidth);
+				paths.push_back(PathState{ Ray(), Color(1, 1, 1), Color(0, 0, 0), Bounce{}, Sampler(pixelIndex, static_cast<uint32_t>(s), this->seed), static_cast<uint32_t>(k - batchStart) });
+				auto& path = paths.back();
+				path.ray = getRay(i, j, stratum % this->sqrtSamplesPerPixel, stratum / this->sqrtSamplesPerPixel, path.sampler);
+			}
+
+			for (int depth = 0; depth < this->maxDepth && !paths.empty(); depth++) {
+				// intersect every path, misses gather background and end
+				records.resize(paths.size());
+				alive.assign(paths.size(), 0);
+				size_t bucketCounts[static_cast<size_t>(MaterialKind::Count)] = {};
+				for (size_t k = 0; k < paths.size(); k++) {
+					auto& path = paths[k];
+					if (!world.hit(path.ray, Interval(0, infinity), records[k])) {
+						path.radiance += path.throughput * this->background;
+						continue;
+					}
+					alive[k] = 1;
+					bucketCounts[static_cast<size_t>(sceneMaterials[records[k].material].kind())]++;
+				}
+				// counting sort the hits by material kind, stable so each bucket stays in path order
+				size_t bucketStart[static_cast<size_t>(MaterialKind::Count)];
+				size_t hits = 0;
+				for (size_t b = 0; b < static_cast<size_t>(MaterialKind::Count); b++) {
+					bucketStart[b] = hits;
+					hits += bucketCounts[b];
+				}
+				order.resize(hits);
+				for (size_t k = 0; k < paths.size(); k++)
+					if (alive[k])
+						order[bucketStart[static_cast<size_t>(sceneMaterials[records[k].material].kind())]++] = static_cast<uint32_t>(k);
+				// shade
+				for (auto k : order) {
+					auto& path = paths[k];
+					alive[k] = this->shade(path.ray, records[k], depth, path.throughput, path.radiance, path.bounce, path.sampler, world);
+				}
+				// compact, finished paths hand their color to the batch results
+				size_t survivors = 0;
+				for (size_t k = 0; k < paths.size(); k++) {
+					if (!alive[k]) {
+						results[paths[k].slot] = paths[k].radiance;
+						continue;
+					}
+					if (survivors != k) {
+						paths[survivors] = std::move(paths[k]);
+						auto& moved = paths[survivors];
+						moved.ray = Ray(moved.ray.origin(), moved.ray.direction(), moved.ray.time(), &moved.sampler);
+					}
+					survivors++;
+				}
+				paths.erase(paths.begin() + survivors, paths.end());
+			}
+			for (const auto& path : paths) // out of bounces
+				results[path.slot] = path.radiance;
+
+			for (auto k = batchStart; k < batchEnd; k++)
+				accumulation.addSample(work[k].first, results[k - batchStart]);
+		}
 	}
-	auto getRay(int i, int j, int sI, int sJ) const -> Ray {
+	/*
+		Split the image into tileSize x tileSize tiles and order them along a Morton (Z-order) curve.
+		Consecutive tiles on the curve are spatial neighbours, so a worker walking its run of tiles
+		keeps hitting the same parts of the scene (and the same BVH nodes) while they are still cached.
+	*/
+	auto mortonOrderedTiles() const -> std::vector<Tile> {
+		auto size = this->tileSize > 0 ? this->tileSize : 16;
+		auto tilesX = (this->imageWidth + size - 1) / size;
+		auto tilesY = (this->imageHeight + size - 1) / size;
+		std::vector<std::pair<uint64_t, Tile>> keyed;
+		keyed.reserve(static_cast<size_t>(tilesX) * tilesY);
+		for (int ty = 0; ty < tilesY; ty++)
+			for (int tx = 0; tx < tilesX; tx++)
+				keyed.push_back({ Camera::mortonCode(tx, ty), Tile{
+					tx * size, ty * size,
+					std::min((tx + 1) * size, this->imageWidth), std::min((ty + 1) * size, this->imageHeight)
+				} });
+		std::sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+		std::vector<Tile> tiles;
+		tiles.reserve(keyed.size());
+		for (const auto& k : keyed)
+			tiles.push_back(k.second);
+		return tiles;
+	}
+	static auto mortonCode(uint32_t x, uint32_t y) -> uint64_t { // interleave bits, x in the even bits, y in the odd
+		auto spread = [](uint64_t v) {
+			v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+			v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+			v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+			v = (v | (v << 2)) & 0x3333333333333333ull;
+			v = (v | (v << 1)) & 0x5555555555555555ull;
+			return v;
+		};
+		return spread(x) | (spread(y) << 1);
+	}
+	auto getRay(int i, int j, int sI, int sJ, Sampler& sampler) const -> Ray {
 		// get a randomly sampled camera ray for the pixel at location i,j,
 		// originating from the camera defocus disk and samples by stratification around the pixel location
 		auto pixelCenter = this->pixel00Location + (i * this->pixelDeltaU) + (j * this->pixelDeltaV);
-		auto pixelSample = pixelCenter + pixelSampleSquare(sI, sJ);
+		auto pixelSample = pixelCenter + pixelSampleSquare(sI, sJ, sampler);
 		auto rayOrigin = this->defocusAngle <= 0
 			? this->center
-			: this->defocusDiskSample();
+			: this->defocusDiskSample(sampler);
 		auto rayDir = pixelSample - rayOrigin;
-		auto rayTime = randomDouble();			// random ray time (between start time 0 and end time 1)
-		return Ray(rayOrigin, rayDir, rayTime);
+		auto rayTime = sampler.next();			// random ray time (between start time 0 and end time 1)
+		return Ray(rayOrigin, rayDir, rayTime, &sampler);
 	}
-	auto pixelSampleSquare(int sI, int sJ) const -> Vec3 {
+	auto pixelSampleSquare(int sI, int sJ, Sampler& sampler) const -> Vec3 {
 		// returns a random point in the square surrouding a pixel at the origin
-		auto px = -0.5 + this->reciprocalSqrtSPP * (sI + randomDouble());
-		auto py = -0.5 + this->reciprocalSqrtSPP * (sJ + randomDouble());
+		auto px = -0.5 + this->reciprocalSqrtSPP * (sI + sampler.next());
+		auto py = -0.5 + this->reciprocalSqrtSPP * (sJ + sampler.next());
 		return (px * this->pixelDeltaU) + (py * this->pixelDeltaV);
 	}
-	auto defocusDiskSample() const -> Point3 {
+	auto defocusDiskSample(Sampler& sampler) const -> Point3 {
 		// Returns a random point in the camera defocus disk.
-		auto p = randomInUnitDisk();
+		auto p = randomInUnitDisk(sampler);
 		return this->center + (p[0] * this->defocusDiskU) + (p[1] * this->defocusDiskV);
 	}
-	auto rayColor(const Ray& r, int depth, const Hittable& world) const -> Color {
+	/*
+		Path tracing loop. Rather than recursing once per bounce, carry the product of every
+		attenuation so far (throughput) and add each emitted contribution scaled by it.
+		After rouletteStartDepth bounces a path survives with probability of its brightest throughput
+		channel (capped at rouletteMaxSurvival) and survivors are divided by that probability, so dim
+		paths end early while the estimate stays unbiased.
+		Lights are found two ways, by a shadow ray aimed at them from every diffuse bounce and by the bounce
+		itself hitting one. Either way the light is weighed by how likely each of the two was to find it
+		(multiple importance sampling, power heuristic), so between them every light counts once, each
+		way carrying the share it is better at: small or far lights by aiming, large or close ones by bouncing.
+	*/
+	auto rayColor(const Ray& cameraRay, const Hittable& world, Sampler& sampler) const -> Color {
 		HitRecord rec;
+		auto hit = this->maxDepth > 0 && world.hit(cameraRay, Interval(0, infinity), rec);
+		return this->continuePath(cameraRay, hit, rec, world, sampler);
+	}
+	// rest of rayColor, for a camera ray whose first intersection (rec, if hit) has already been found
+	auto continuePath(const Ray& cameraRay, bool hit, HitRecord& rec, const Hittable& world, Sampler& sampler) const -> Color {
+		Color radiance(0, 0, 0);
+		Color throughput(1, 1, 1);
+		Bounce bounce; // the camera ray's, no light sampling to weigh against
+		Ray r = cameraRay;
+
+		for (int depth = 0; depth < this->maxDepth; depth++) { // stop gathering if max depth
+			if (depth > 0)
+				hit = world.hit(r, Interval(0, infinity), rec);
+			if (!hit) { // if hit nothing, gather background
+				radiance += throughput * this->background;
+				break;
+			}
+			if (!this->shade(r, rec, depth, throughput, radiance, bounce, sampler, world))
+				break;
+		}
+		return radiance;
+	}
+	/*
+		One path vertex: gather the hit's emission, scatter, sample a light and play roulette.
+		Returns whether the path goes on, in which case r is replaced by the scattered ray and bounce by where it left from.
+		No light is sampled from the last vertex, its bounce never gets to hit one either.
+	*/
+	auto shade(Ray& r, const HitRecord& rec, int depth, Color& throughput, Color& radiance, Bounce& bounce, Sampler& sampler, const Hittable& world) const -> bool {
+		const auto& material = sceneMaterials[rec.material];
+		auto emitted = material.emitted(rec.u, rec.v, rec.p);
+		if (bounce.pdf > 0 && material.kind() == MaterialKind::DiffuseLight) {
+			auto lightPdf = this->lights.pdf(bounce.from, bounce.normal, rec, r.time());
+			if (lightPdf > 0) emitted = emitted * Camera::powerHeuristic(bounce.pdf, lightPdf);
+		}
+		radiance += throughput * emitted;
 
-		if (depth <= 0) // stop gathering if max depth
-			return Color(0, 0, 0);
-		if (!world.hit(r, Interval(0.001, infinity), rec)) // if hit nothing, return background. still sets rec
-			return this->background;
-		
 		Ray scattered;
 		Color attenuation;
-		Color colorFromEmission = rec.material->emitted(rec.u, rec.v, rec.p);
-		if (!rec.material->scatter(r, rec, attenuation, scattered)) // if no longer casting, off material, return emitted val. sets scattered
-			return colorFromEmission;
-		
-		Color colorFromScatter = attenuation * this->rayColor(scattered, depth - 1, world);
-		return colorFromEmission + colorFromScatter;
+		if (!material.scatter(r, rec, attenuation, scattered, sampler)) // absorbed (or light), path ends. sets scattered
+			return false;
+		bounce.pdf = this->lights.empty() ? 0 : material.scatteringPdf(r, rec, scattered.direction());
+		if (bounce.pdf > 0) {
+			bounce.from = rec.p;
+			bounce.normal = material.kind() == MaterialKind::Isotropic ? Vec3(0, 0, 0) : rec.normal; // a volume takes light from every side
+			if (depth + 1 < this->maxDepth)
+				radiance += throughput * attenuation * this->sampleLight(r, rec, bounce.normal, material, world, sampler);
+		}
+		throughput = throughput * attenuation;
+
+		if (depth + 1 >= this->rouletteStartDepth) {
+			auto survival = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), this->rouletteMaxSurvival);
+			if (sampler.next() >= survival)
+				return false;
+			throughput /= survival;
+		}
+		sampler.nextBounce(); // fresh random dimensions for the next path vertex
+		r = scattered;
+		return true;
+	}
+	/*
+		Light arriving at rec from a point picked on the lights, if nothing is in the way, times how much of it
+		the material scatters toward r over its attenuation (which the caller multiplies in), weighed against
+		the material's bounce finding the same point.
+	*/
+	auto sampleLight(const Ray& r, const HitRecord& rec, const Vec3& normal, const Material& material, const Hittable& world, Sampler& sampler) const -> Color {
+		LightList::Sample light;
+		if (!this->lights.sample(rec.p, normal, r.time(), sampler, light))
+			return Color(0, 0, 0);
+		auto pdf = material.scatteringPdf(r, rec, light.toLight);
+		if (pdf <= 0) return Color(0, 0, 0); // behind the surface
+		auto shadowRay = rec.spawnRayTo(rec.p + light.toLight, light.normal, r.time(), &sampler);
+		if (world.occluded(shadowRay, Interval(0, 1))) // t = 1 is just off the light, on this side
+			return Color(0, 0, 0);
+		return light.radiance * (pdf * Camera::powerHeuristic(light.pdf, pdf) / light.pdf);
+	}
+	// share of a sample taken with pdf, against a strategy with otherPdf for the same point (as a ratio, so huge pdfs stay finite)
+	static auto powerHeuristic(Real pdf, Real otherPdf) -> Real {
+		auto ratio = otherPdf / pdf;
+		return 1 / (1 + ratio * ratio);
 	}
 };
@@ -8,26 +8,26 @@
 
 class ConstantMedium : public Hittable {
 	shared_ptr<Hittable> boundary;
-	double negInvDensity;
-	shared_ptr<Material> phaseFunction;
+	Real negInvDensity;
+	MaterialHandle phaseFunction;
 
 public:
-	ConstantMedium(shared_ptr<Hittable> b, double d, shared_ptr<Texture> a) :
+	ConstantMedium(shared_ptr<Hittable> b, Real d, shared_ptr<Texture> a) :
 		boundary(b),
 		negInvDensity(-1 / d),
-		phaseFunction(make_shared<Isotropic>(a))
+		phaseFunction(sceneMaterials.add(make_shared<Isotropic>(a)))
 	{}
-	ConstantMedium(shared_ptr<Hittable> b, double d, Color c) :
+	ConstantMedium(shared_ptr<Hittable> b, Real d, Color c) :
 		boundary(b),
 		negInvDensity(-1 / d),
-		phaseFunction(make_shared<Isotropic>(c))
+		phaseFunction(sceneMaterials.add(make_shared<Isotropic>(c)))
 	{}
 
-	auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
+	auto intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
 		HitRecord rec1, rec2;
-		if (!this->boundary->hit(r, Interval::universe, rec1))
+		if (!this->boundary->intersect(r, Interval::universe, rec1))
 			return false;
-		if (!this->boundary->hit(r, Interval(rec1.t + 0.0001, infinity), rec2))
+		if (!this->boundary->intersect(r, Interval(rec1.t + 0.0001, infinity), rec2))
 			return false;
 		if (rec1.t < rayT.min) rec1.t = rayT.min;
 		if (rec2.t > rayT.max) rec2.t = rayT.max;
@@ -36,15 +36,18 @@ public:
 		if (rec1.t < 0) rec1.t = 0;
 		auto rayLen = r.direction().length();
 		auto distanceInsideBoundary = (rec2.t - rec1.t) * rayLen;
-		auto hitDistance = negInvDensity * log(randomDouble());
+		auto sampler = r.sampler();
+		auto hitDistance = negInvDensity * log(sampler ? sampler->next() : randomDouble());
 		if (hitDistance > distanceInsideBoundary)
 			return false;
-		rec.t = rec1.t + hitDistance / rayLen;
+		rec.setHit(rec1.t + hitDistance / rayLen, this);
+		return true;
+	}
+	auto finalize(const Ray& r, HitRecord& rec) const -> void override {
 		rec.p = r.at(rec.t);
-		rec.normal = Vec3(1, 0, 0); // arbitrary
+		rec.normal = rec.geometricNormal = Vec3(1, 0, 0); // arbitrary
 		rec.frontFace = true; // arbitrary
 		rec.material = this->phaseFunction;
-		return true;
 	}
 	auto boundingBox() const -> AxisAlignedBoundingBox override { return this->boundary->boundingBox(); }
 };
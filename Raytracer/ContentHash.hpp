@@ -0,0 +1,60 @@
+#pragma once
+
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+	64 bit hash of everything that went into making something, to tell whether a cached result of it is
+	still good: add the input files, the parameters, a version for the code, and compare.
+	Each 8 bytes are xored in, multiplied by an odd constant and folded down (value ^= value >> 32),
+	so every input bit reaches every output bit within a couple of words. Fast enough to hash a large
+	model in a fraction of the time it takes to parse it, not meant to stand up to anyone forging collisions.
+	Every add also mixes in its length, so ("ab", "c") and ("a", "bc") hash differently.
+*/
+struct ContentHash {
+	uint64_t value = 0x9E3779B97F4A7C15;
+
+	auto add(const void* data, size_t size) -> ContentHash& {
+		const auto* bytes = static_cast<const unsigned char*>(data);
+		for (; size >= 8; bytes += 8, size -= 8) {
+			uint64_t word;
+			std::memcpy(&word, bytes, 8);
+			this->mix(word);
+		}
+		uint64_t tail = 0;
+		if (size > 0) std::memcpy(&tail, bytes, size);
+		this->mix(tail ^ (static_cast<uint64_t>(size) << 56));
+		return *this;
+	}
+	template <typename T> requires std::is_arithmetic_v<T>
+	auto add(T number) -> ContentHash& {
+		return this->add(&number, sizeof(T));
+	}
+	auto add(std::string_view text) -> ContentHash& {
+		this->add(text.size());
+		return this->add(text.data(), text.size());
+	}
+	// the file's bytes (not its name or date), false (after printing why) when it can't be read
+	auto addFile(const std::string& path) -> bool {
+		MappedFile file;
+		if (!file.open(path)) {
+			std::cerr << "ERROR: Could not open '" << path << "'.\n";
+			return false;
+		}
+		this->add(file.size());
+		this->add(file.data(), file.size());
+		return true;
+	}
+
+private:
+	auto mix(uint64_t word) -> void {
+		this->value = (this->value ^ word) * 0x9FB21C651E98DF25;
+		this->value ^= this->value >> 32;
+	}
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "common.hpp"
+#include "Color.hpp"
+
+#include <vector>
+
+/*
+	Whole rendered image in linear (not gamma corrected, not clamped) color.
+	Row 0 is the top of the image, pixels are stored row by row.
+*/
+struct Framebuffer {
+	int width;
+	int height;
+	std::vector<Color> pixels;
+
+	Framebuffer(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w) * h, Color(0, 0, 0)) {}
+
+	auto at(int i, int j) -> Color& { return pixels[static_cast<size_t>(j) * width + i]; }
+	auto at(int i, int j) const -> const Color& { return pixels[static_cast<size_t>(j) * width + i]; }
+};
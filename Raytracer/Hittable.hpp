@@ -2,17 +2,44 @@
 
 #include "common.hpp"
 #include "AxisAlignedBoundingBox.hpp"
+#include "RayPacket.hpp"
+#include "AffineTransform.hpp"
+#include "MaterialTable.hpp"
 
-struct Material; // forward declaration
+#include <bit>
+
+struct Hittable;
+class Instance;
 
 struct HitRecord {
+	static constexpr uint8_t maxInstanceDepth = 2;
+
 	Point3 p;
-	Vec3 normal;
-	shared_ptr<Material> material;
-	double t;
-	double u;
-	double v;
+	Vec3 normal;			// for shading, on the same side as geometricNormal
+	Vec3 geometricNormal;	// of the surface itself, facing the ray, which side spawned rays start on
+	Real t;
+	Real u;
+	Real v;
+	MaterialHandle material;
 	bool frontFace;
+	/*
+		Left by the query for finalize (see Hittable): the primitive that was hit and which of its parts
+		(a sphere of a set, a triangle of a mesh), with u, v holding where on that part (ie barycentrics)
+		until finalize turns them into texture coordinates. instances are the Instances the ray went
+		through on the way there, innermost first.
+	*/
+	uint8_t instanceDepth;
+	uint32_t primitive;
+	const Hittable* object;
+	const Instance* instances[maxInstanceDepth];
+
+	// what a query stores on a hit, besides anything the primitive wants back in u, v
+	auto setHit(Real _t, const Hittable* _object, uint32_t _primitive = 0) -> void {
+		this->t = _t;
+		this->object = _object;
+		this->primitive = _primitive;
+		this->instanceDepth = 0;
+	}
 
 	/*
 		Normal is always pointing outward of sphere, but sometimes ray
@@ -33,176 +60,239 @@ struct HitRecord {
 	inline void setFaceNormal(const Ray& r, const Vec3& outwardNormal) {
 		this->frontFace = dot(r.direction(), outwardNormal) < 0;	// true if inside, false otherwise
 		this->normal = frontFace ? outwardNormal : -outwardNormal;
+		this->geometricNormal = this->normal;
+	}
+	// a normal for shading only (ie interpolated vertex normals), flipped to the side setFaceNormal found
+	inline void setShadingNormal(const Vec3& shadingNormal) {
+		this->normal = dot(shadingNormal, this->geometricNormal) < 0 ? -shadingNormal : shadingNormal;
+	}
+	/*
+		Ray leaving the hit point. Its origin is pushed just off the surface, onto the side the ray heads to,
+		so it cannot hit the same surface again through rounding error and needs no t-min of its own.
+	*/
+	auto spawnRay(const Vec3& direction, Real time, Sampler* sampler) const -> Ray {
+		auto n = this->geometricNormal;
+		return Ray(offsetRayOrigin(this->p, dot(direction, n) < 0 ? -n : n), direction, time, sampler);
+	}
+	/*
+		Ray from just off this surface to just off another one, at to with normal toNormal (either side), reaching
+		it at t = 1. Both ends are pushed off their surfaces, so testing (0, 1) for anything in between
+		finds neither of them, however far the two are apart.
+	*/
+	auto spawnRayTo(const Point3& to, const Vec3& toNormal, Real time, Sampler* sampler) const -> Ray {
+		auto n = this->geometricNormal;
+		auto from = offsetRayOrigin(this->p, dot(to - this->p, n) < 0 ? -n : n);
+		auto target = offsetRayOrigin(to, dot(from - to, toNormal) < 0 ? -toNormal : toNormal);
+		return Ray(from, target - from, time, sampler);
 	}
 };
 
+/*
+	Closest hit of every lane of a RayPacket so far. tMax only ever shrinks,
+	so later tests skip anything behind a hit already found.
+*/
+struct PacketHitRecord {
+	alignas(32) Real tMax[RayPacket::width];
+	uint32_t hitMask = 0;
+	HitRecord records[RayPacket::width];
+
+	PacketHitRecord(Real _tMax) {
+		for (int lane = 0; lane < RayPacket::width; lane++)
+			this->tMax[lane] = _tMax;
+	}
+};
+
+inline auto finalizeHit(const Ray& r, HitRecord& rec) -> void;
+
+class LightList;
+/*
+	Where an object sits while the lights are gathered (see Hittable::gatherLights): the transform that
+	places it in the world and the Instances on the way down to it, outermost first.
+*/
+struct InstancePath {
+	AffineTransform toWorld;
+	uint32_t depth = 0;
+	const Instance* instances[HitRecord::maxInstanceDepth] = {};
+};
+
 /*
 	Sometimes useful to have t_min and t_max where a hit is occuring rather than just one t
 	Normal of the closest is the only one that matters
+
+	So a hit comes in two steps. intersect is the query, run against everything the ray might hit: it
+	works out t and where on the primitive (HitRecord::setHit) and nothing else, and leaves rec alone on
+	a miss, so containers hand one record down and the closest hit simply ends up in it. finalize then
+	works out the rest (point, normal, texture coordinates, material) once, for that closest hit only,
+	instead of for every candidate the search threw away. hit and hitPacket do both.
+	occluded only asks whether anything is in the way (shadow and visibility rays): no record at all, and
+	the search may stop at the first hit it comes across, whichever that is.
 */
 struct Hittable {
-	virtual auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool = 0;
+	virtual auto intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool = 0;
+	// fill in the rest of rec for the hit intersect left there, r in this object's own space. Primitives only
+	virtual auto finalize(const Ray&, HitRecord&) const -> void {}
 	virtual auto boundingBox() const -> AxisAlignedBoundingBox = 0;
+	/*
+		Whether r hits anything within rayT. A primitive's query already skips its shading, so by default
+		this is intersect into a record thrown away, anything holding many primitives overrides it to stop
+		at the first.
+	*/
+	virtual auto occluded(const Ray& r, Interval rayT) const -> bool {
+		HitRecord rec;
+		return this->intersect(r, rayT, rec);
+	}
+	// hand the lights in here (see LightList) to lights, placed by path. Containers pass it on, most things have none
+	virtual auto gatherLights(LightList&, const InstancePath&) const -> void {}
+	/*
+		Find the closest hit for each lane in mask. By default every lane is traced as a single ray,
+		containers that can share work between the lanes (lists, BVH nodes) override this.
+	*/
+	virtual auto intersectPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void {
+		for (int lane = 0; lane < RayPacket::width; lane++) {
+			if (!(mask & (1u << lane))) continue;
+			if (this->intersect(packet.rays[lane], Interval(packet.tMin, hits.tMax[lane]), hits.records[lane])) {
+				hits.tMax[lane] = hits.records[lane].t;
+				hits.hitMask |= 1u << lane;
+			}
+		}
+	}
+
+	auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool {
+		if (!this->intersect(r, rayT, rec))
+			return false;
+		finalizeHit(r, rec);
+		return true;
+	}
+	auto hitPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void {
+		alignas(32) Real tBefore[RayPacket::width];
+		for (int lane = 0; lane < RayPacket::width; lane++)
+			tBefore[lane] = hits.tMax[lane];
+		this->intersectPacket(packet, mask, hits);
+		for (auto m = mask; m; m &= m - 1) {
+			auto lane = std::countr_zero(m);
+			if (hits.tMax[lane] < tBefore[lane]) finalizeHit(packet.rays[lane], hits.records[lane]);
+		}
+	}
 };
 
-class Translate : public Hittable {
+/*
+	An object placed in the world by an affine transform, without copying it: many instances can share
+	one object (ie a BVH of a thousand spheres, or a mesh) and a BVH over the instances puts them all
+	in one scene, the classic two level (top level over instances, bottom level per shared object) layout.
+	Both directions of the transform are worked out once here. A ray is carried into the object's space
+	rather than the object into the world: its direction is transformed but not renormalized, so t is the
+	same distance along it in both spaces and the hit needs no conversion back.
+	The hit point and normal return to the world, the normal through the inverse transpose (see
+	AffineTransform), renormalized only when the transform scales or shears. That keeps it opposing the
+	ray, so frontFace carries over too.
+	Wrapping an Instance in another one composes the two into a single matrix around the innermost object.
+	The query only notes the instance on the record, the way back out happens in finalizeHit.
+*/
+class Instance : public Hittable {
 	shared_ptr<Hittable> obj;
-	Vec3 offset;
+	AffineTransform objectToWorld;
+	AffineTransform worldToObject;
 	AxisAlignedBoundingBox bbox;
+	bool rigid;		// objectToWorld keeps unit normals unit
+
+	// note on rec that its hit came through here
+	auto enter(const Ray& objectRay, HitRecord& rec) const -> void {
+		if (rec.instanceDepth == HitRecord::maxInstanceDepth) {
+			// nested deeper than a record can note, finish the hit inside this instance right away
+			finalizeHit(objectRay, rec);
+			rec.object = nullptr;
+			rec.instanceDepth = 0;
+		}
+		rec.instances[rec.instanceDepth++] = this;
+	}
 
 public:
-	Translate(shared_ptr<Hittable> p, const Vec3& displacement) : obj(p), offset(displacement) {
-		this->bbox = this->obj->boundingBox() + this->offset;
-	}
-	auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
-		// Move the ray backwards by the offset
-		Ray rOffset(r.origin() - this->offset, r.direction(), r.time());
-		// Determine where (if any) an intersection occurs along the offset ray on the wrapped obj
-		if (!this->obj->hit(rOffset, rayT, rec))
+	auto toObject(const Ray& r) const -> Ray {
+		return Ray(this->worldToObject.point(r.origin()), this->worldToObject.vector(r.direction()), r.time(), r.sampler());
+	}
+	auto toWorld(HitRecord& rec) const -> void {
+		rec.p = this->objectToWorld.point(rec.p);
+		rec.normal = this->worldToObject.transposedVector(rec.normal);
+		rec.geometricNormal = this->worldToObject.transposedVector(rec.geometricNormal);
+		if (!this->rigid) {
+			rec.normal = unitVector(rec.normal);
+			rec.geometricNormal = unitVector(rec.geometricNormal);
+		}
+	}
+
+	Instance(shared_ptr<Hittable> object, const AffineTransform& transform) {
+		if (auto inner = std::dynamic_pointer_cast<Instance>(object)) {
+			this->obj = inner->obj;
+			this->objectToWorld = transform * inner->objectToWorld;
+		}
+		else {
+			this->obj = object;
+			this->objectToWorld = transform;
+		}
+		this->worldToObject = this->objectToWorld.inverse();
+		this->bbox = this->objectToWorld.box(this->obj->boundingBox());
+		this->rigid = this->objectToWorld.isRigid();
+	}
+	auto intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
+		auto objectRay = this->toObject(r);
+		if (!this->obj->intersect(objectRay, rayT, rec))
 			return false;
-		// Move the intersection point forwards by the offset
-		rec.p += this->offset;
+		this->enter(objectRay, rec);
 		return true;
 	}
+	auto occluded(const Ray& r, Interval rayT) const -> bool override {
+		return this->obj->occluded(this->toObject(r), rayT);
+	}
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		if (path.depth == HitRecord::maxInstanceDepth) return; // hits down there don't note every instance (see enter), so they couldn't be told apart
+		auto inner = path;
+		inner.toWorld = path.toWorld * this->objectToWorld;
+		inner.instances[inner.depth++] = this;
+		this->obj->gatherLights(lights, inner);
+	}
+	// the whole packet goes into object space, so a shared BVH still gets walked once for all lanes
+	auto intersectPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void override {
+		Ray rays[RayPacket::width];
+		alignas(32) Real tBefore[RayPacket::width];
+		for (int lane = 0; lane < packet.count; lane++) {
+			rays[lane] = this->toObject(packet.rays[lane]);
+			tBefore[lane] = hits.tMax[lane];
+		}
+		this->obj->intersectPacket(RayPacket(rays, packet.count, packet.tMin), mask, hits);
+		for (auto m = mask; m; m &= m - 1) {
+			auto lane = std::countr_zero(m);
+			if (hits.tMax[lane] < tBefore[lane]) this->enter(rays[lane], hits.records[lane]);
+		}
+	}
 	auto boundingBox() const -> AxisAlignedBoundingBox override { return this->bbox; }
+	auto object() const -> const shared_ptr<Hittable>& { return this->obj; }
+	auto transform() const -> const AffineTransform& { return this->objectToWorld; }
 };
 
-class Rotate : public Hittable {
-	shared_ptr<Hittable> obj;
-	Vec3 rotation;
-	AxisAlignedBoundingBox bbox;
+/*
+	Second step of a hit (see Hittable): carry the ray into the space of the primitive that was hit,
+	through the instances on the way, outermost first, let the primitive finish the record, then bring
+	point and normal back out. A record without an object was finished inside an instance already and
+	only has the way out left.
+*/
+inline auto finalizeHit(const Ray& r, HitRecord& rec) -> void {
+	if (rec.object) {
+		auto objectRay = r;
+		for (auto i = rec.instanceDepth; i > 0; i--)
+			objectRay = rec.instances[i - 1]->toObject(objectRay);
+		rec.object->finalize(objectRay, rec);
+	}
+	for (uint8_t i = 0; i < rec.instanceDepth; i++)
+		rec.instances[i]->toWorld(rec);
+}
 
+class Translate : public Instance {
 public:
-	Rotate(shared_ptr<Hittable> p, const Vec3& degrees) : obj(p) {
-		this->rotation = Vec3(
-			degreesToRadians(degrees.x()),
-			degreesToRadians(degrees.y()),
-			degreesToRadians(degrees.z())
-		);
-		this->bbox = this->obj->boundingBox();
-
-		Point3 min(infinity, infinity, infinity);
-		Point3 max(-infinity, -infinity, -infinity);
-
-		const float c3 = cos(this->rotation.z());
-		const float s3 = sin(this->rotation.z());
-		const float c2 = cos(this->rotation.x());
-		const float s2 = sin(this->rotation.x());
-		const float c1 = cos(this->rotation.y());
-		const float s1 = sin(this->rotation.y());
-
-		for (int i = 0; i < 2; i++)
-			for (int j = 0; j < 2; j++)
-				for (int k = 0; k < 2; k++) {
-					auto x = i * this->bbox.x.max + (1 - i) * bbox.x.min;
-					auto y = j * this->bbox.y.max + (1 - j) * bbox.y.min;
-					auto z = k * this->bbox.z.max + (1 - k) * bbox.z.min;
-					auto nx = x * (c1 * c3 + s1 * s2 * s3)
-						+ y * (c2 * s3)
-						+ z * (c1 * s2 * s3 - c3 * s1);
-					auto ny = x * (c3 * s2 * s2 - c1 * s3)
-						+ y * (c2 * c3)
-						+ z * (c1 * c3 * s2 + s1 * s3);
-					auto nz = x * (c2 * s1)
-						+ y * (-s2)
-						+ z * (c1 * c2);
-
-					Vec3 tester(nx, ny, nz);
-					for (int c = 0; c < 3; c++) {
-						min[c] = fmin(min[c], tester[c]);
-						max[c] = fmax(max[c], tester[c]);
-					}
-				}
-		this->bbox = AxisAlignedBoundingBox(min, max);
-	}
-	auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
-		// change ray from world space to object space
-		auto origin = r.origin();
-		auto direction = r.direction();
-
-		// y x z Tait-Bryan Angle (Euler Angle) https://en.wikipedia.org/wiki/Euler_angles#Rotation_matrix
-		const float c3 = cos(this->rotation.z());
-		const float s3 = sin(this->rotation.z());
-		const float c2 = cos(this->rotation.x());
-		const float s2 = sin(this->rotation.x());
-		const float c1 = cos(this->rotation.y());
-		const float s1 = sin(this->rotation.y());
-		// need to do inverse transform because we're applying to ray, not shape itself
-		/* for the inverse, because a rotation matrix is always ornthonormal,
-			if R = R(pitch)R(yaw)R(roll), then R^-1 = R^T
-				= (R(pitch)R(yaw)R(roll))^T
-				= R(roll)^T R(yaw)^T R(pitch)^T
-			[ a d g
-			  b e h
-			  c f i ]
-			a = c1 * c3 + s1 * s2 * s3. b = c3 * s1 * s2 - c1 * s3. c = c2 * s1
-			d = c2 * s3. e = c2 * c3. f = -s2
-			g = c1 * s2 * s3 - c3 * s1. h = c1 * c3 * s2 + s1 * s3. i = c1 * c2
-		*/
-		Point3 unrotOrigin(
-			origin[0] * (c1 * c3 + s1 * s2 * s3)
-			+ origin[1] * (c2 * s3)
-			+ origin[2] * (c1 * s2 * s3 - c3 * s1),
-			origin[0] * (c3 * s2 * s2 - c1 * s3)
-			+ origin[1] * (c2 * c3)
-			+ origin[2] * (c1 * c3 * s2 + s1 * s3),
-			origin[0] * (c2 * s1)
-			+ origin[1] * (-s2)
-			+ origin[2] * (c1 * c2)
-		);
-		
-		Vec3 unrotDirection(
-			direction[0] * (c1 * c3 + s1 * s2 * s3)
-			+ direction[1] * (c2 * s3)
-			+ direction[2] * (c1 * s2 * s3 - c3 * s1),
-			direction[0] * (c3 * s2 * s2 - c1 * s3)
-			+ direction[1] * (c2 * c3)
-			+ direction[2] * (c1 * c3 * s2 + s1 * s3),
-			direction[0] * (c2 * s1)
-			+ direction[1] * (-s2)
-			+ direction[2] * (c1 * c2)
-		);
-		
-		Ray rRotated(unrotOrigin, unrotDirection, r.time());
-
-		// Determine where (if any) an intersection occurs in object space
-		if (!this->obj->hit(rRotated, rayT, rec))
-			return false;
+	Translate(shared_ptr<Hittable> p, const Vec3& displacement) : Instance(p, AffineTransform::translation(displacement)) {}
+};
 
-		// Change the intersection point from object space to world space
-		auto p = rec.p;
-		/* Normal transformation to go back
-			[ a b c
-			  d e f
-			  g h i ]
-		*/
-		Point3 rotP(
-			p[0] * (c1 * c3 + s1 * s2 * s3)
-			+ p[1] * (c3 * s1 * s2 - c1 * s3)
-			+ p[2] * (c2 * s1),
-			p[0] * (c2 * s3)
-			+ p[1] * (c2 * c3)
-			+ p[2] * (-s2),
-			p[0] * (c1 * s2 * s3 - c3 * s1)
-			+ p[1] * (c1 * c3 * s2 + s1 * s3)
-			+ p[2] * (c1 * c2)
-		);
-		auto normal = rec.normal;
-		Vec3 rotNormal(
-			normal[0] * (c1 * c3 + s1 * s2 * s3)
-			+ normal[1] * (c3 * s1 * s2 - c1 * s3)
-			+ normal[2] * (c2 * s1),
-			normal[0] * (c2 * s3)
-			+ normal[1] * (c2 * c3)
-			+ normal[2] * (-s2),
-			normal[0] * (c1 * s2 * s3 - c3 * s1)
-			+ normal[1] * (c1 * c3 * s2 + s1 * s3)
-			+ normal[2] * (c1 * c2)
-		);
-
-		rec.p = rotP;
-		rec.normal = rotNormal;
-		return true;
-	}
-	auto boundingBox() const -> AxisAlignedBoundingBox override { return this->bbox; }
+// degrees about y, then x, then z (see AffineTransform::rotation)
+class Rotate : public Instance {
+public:
+	Rotate(shared_ptr<Hittable> p, const Vec3& degrees) : Instance(p, AffineTransform::rotation(degrees)) {}
 };
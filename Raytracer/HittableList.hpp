@@ -26,7 +26,20 @@ public:
 		this->bbox = AxisAlignedBoundingBox(this->bbox, object->boundingBox());
 	}
 
-	virtual auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override;
+	virtual auto intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override;
+	auto occluded(const Ray& r, Interval rayT) const -> bool override {
+		for (const auto& object : this->objects)
+			if (object->occluded(r, rayT)) return true;
+		return false;
+	}
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		for (const auto& object : this->objects)
+			object->gatherLights(lights, path);
+	}
+	auto intersectPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void override {
+		for (const auto& object : this->objects)
+			object->intersectPacket(packet, mask, hits);
+	}
 	auto boundingBox() const -> AxisAlignedBoundingBox override {
 		return this->bbox;
 	}
@@ -34,17 +47,16 @@ public:
 
 /*
 	Attempts to hit anything in this List. Closests is stored in HitRecord.
+	A miss leaves rec alone, so every object can query straight into it.
 */
-auto HittableList::hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool {
-	HitRecord temp_rec;
+auto HittableList::intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool {
 	bool hitAnything = false;
 	auto closestSoFar = rayT.max;
 	
 	for (const auto& object : this->objects) {
-		if (object->hit(r, Interval(rayT.min, closestSoFar), temp_rec)) {
+		if (object->intersect(r, Interval(rayT.min, closestSoFar), rec)) {
 			hitAnything = true;
-			closestSoFar = temp_rec.t;
-			rec = temp_rec;
+			closestSoFar = rec.t;
 		}
 	}
 
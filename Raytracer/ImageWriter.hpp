@@ -0,0 +1,269 @@
+#pragma once
+
+#include "common.hpp"
+#include "Color.hpp"
+#include "Framebuffer.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/*
+	Last stage of a render, turns the linear framebuffer into a file.
+	Writers encode the image in parallel chunks into memory and hand the result to the
+	file in one write, so output never goes through per component text formatting.
+*/
+struct ImageWriter {
+	virtual ~ImageWriter() = default;
+	virtual auto write(const Framebuffer& image, const std::string& path, ThreadPool& pool) const -> bool = 0;
+
+protected:
+	static auto writeFile(const std::string& path, const std::string& header, const std::vector<char>& body) -> bool {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out) {
+			std::cerr << "ERROR: Could not open '" << path << "' for writing.\n";
+			return false;
+		}
+		out.write(header.data(), header.size());
+		out.write(body.data(), body.size());
+		out.close(); // a full disk may only show up when the last of the buffer is flushed
+		if (!out) {
+			std::cerr << "ERROR: Failed writing '" << path << "'.\n";
+			return false;
+		}
+		return true;
+	}
+};
+
+// Binary PPM (P6), gamma corrected 8 bit. Display only, loses everything above 1.0
+class PPMWriter : public ImageWriter {
+public:
+	auto write(const Framebuffer& image, const std::string& path, ThreadPool& pool) const -> bool override {
+		auto rowBytes = static_cast<size_t>(image.width) * 3;
+		std::vector<char> body(rowBytes * image.height);
+		parallelFor(pool, image.height, 16, [&](size_t begin, size_t end) {
+			for (auto j = begin; j < end; j++) {
+				auto out = reinterpret_cast<unsigned char*>(body.data() + j * rowBytes);
+				for (int i = 0; i < image.width; i++) {
+					const auto& pixel = image.at(i, static_cast<int>(j));
+					*out++ = toDisplayByte(pixel.x());
+					*out++ = toDisplayByte(pixel.y());
+					*out++ = toDisplayByte(pixel.z());
+				}
+			}
+		});
+		auto header = "P6\n" + std::to_string(image.width) + ' ' + std::to_string(image.height) + "\n255\n";
+		return ImageWriter::writeFile(path, header, body);
+	}
+};
+
+/*
+	Portable Float Map, linear 32 bit float RGB. Keeps full HDR range for post.
+	Rows are stored bottom to top, a negative scale marks little endian data.
+*/
+class PFMWriter : public ImageWriter {
+public:
+	auto write(const Framebuffer& image, const std::string& path, ThreadPool& pool) const -> bool override {
+		auto rowFloats = static_cast<size_t>(image.width) * 3;
+		std::vector<char> body(rowFloats * image.height * sizeof(float));
+		parallelFor(pool, image.height, 16, [&](size_t begin, size_t end) {
+			for (auto j = begin; j < end; j++) {
+				auto out = body.data() + (image.height - 1 - j) * rowFloats * sizeof(float);
+				for (int i = 0; i < image.width; i++) {
+					const auto& pixel = image.at(i, static_cast<int>(j));
+					float rgb[3] = { static_cast<float>(pixel.x()), static_cast<float>(pixel.y()), static_cast<float>(pixel.z()) };
+					std::memcpy(out, rgb, sizeof(rgb));
+					out += sizeof(rgb);
+				}
+			}
+		});
+		auto scale = std::endian::native == std::endian::little ? "-1.0" : "1.0";
+		auto header = "PF\n" + std::to_string(image.width) + ' ' + std::to_string(image.height) + '\n' + scale + '\n';
+		return ImageWriter::writeFile(path, header, body);
+	}
+};
+
+/*
+	OpenEXR, scanline image of half float B, G, R channels with RLE compression.
+	RLE compresses one scanline per chunk, so every scanline is encoded independently (in parallel)
+	and the offset table is filled in afterwards.
+	Layout:
+		magic, version
+		header attributes (name, type, size, value), terminated by an empty name
+		offset table, one absolute file offset per chunk
+		chunks: y, compressed size, data (each channel's scanline of halves, channels alphabetical)
+*/
+class EXRWriter : public ImageWriter {
+public:
+	auto write(const Framebuffer& image, const std::string& path, ThreadPool& pool) const -> bool override {
+		std::vector<std::vector<char>> chunks(image.height);
+		parallelFor(pool, image.height, 8, [&](size_t begin, size_t end) {
+			for (auto j = begin; j < end; j++)
+				chunks[j] = EXRWriter::encodeScanline(image, static_cast<int>(j));
+		});
+
+		std::string header;
+		EXRWriter::put<uint32_t>(header, 20000630);	// magic
+		EXRWriter::put<uint32_t>(header, 2);		// version 2, single part scanline
+		std::string channels;
+		for (auto name : { "B", "G", "R" }) {
+			channels += name;
+			channels += '\0';
+			EXRWriter::put<int32_t>(channels, 1);	// HALF
+			EXRWriter::put<uint32_t>(channels, 0);	// pLinear + reserved
+			EXRWriter::put<int32_t>(channels, 1);	// x sampling
+			EXRWriter::put<int32_t>(channels, 1);	// y sampling
+		}
+		channels += '\0';
+		std::string box;
+		for (auto v : { 0, 0, image.width - 1, image.height - 1 })
+			EXRWriter::put<int32_t>(box, v);
+		std::string window;
+		EXRWriter::put<float>(window, 0.0f);
+		EXRWriter::put<float>(window, 0.0f);
+		std::string one;
+		EXRWriter::put<float>(one, 1.0f);
+		EXRWriter::attribute(header, "channels", "chlist", channels);
+		EXRWriter::attribute(header, "compression", "compression", std::string(1, '\1')); // RLE
+		EXRWriter::attribute(header, "dataWindow", "box2i", box);
+		EXRWriter::attribute(header, "displayWindow", "box2i", box);
+		EXRWriter::attribute(header, "lineOrder", "lineOrder", std::string(1, '\0')); // increasing y
+		EXRWriter::attribute(header, "pixelAspectRatio", "float", one);
+		EXRWriter::attribute(header, "screenWindowCenter", "v2f", window);
+		EXRWriter::attribute(header, "screenWindowWidth", "float", one);
+		header += '\0';
+
+		uint64_t offset = header.size() + sizeof(uint64_t) * image.height;
+		for (const auto& chunk : chunks) {
+			EXRWriter::put<uint64_t>(header, offset);
+			offset += chunk.size();
+		}
+		std::vector<char> body;
+		body.reserve(offset - header.size());
+		for (const auto& chunk : chunks)
+			body.insert(body.end(), chunk.begin(), chunk.end());
+		return ImageWriter::writeFile(path, header, body);
+	}
+
+private:
+	template <typename T>
+	static auto put(std::string& out, T value) -> void { // file is little endian
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		if constexpr (std::endian::native == std::endian::big)
+			std::reverse(bytes, bytes + sizeof(T));
+		out.append(bytes, sizeof(T));
+	}
+	static auto attribute(std::string& out, const char* name, const char* type, const std::string& value) -> void {
+		out += name;
+		out += '\0';
+		out += type;
+		out += '\0';
+		EXRWriter::put<int32_t>(out, static_cast<int32_t>(value.size()));
+		out += value;
+	}
+	static auto encodeScanline(const Framebuffer& image, int j) -> std::vector<char> {
+		std::string raw;
+		raw.reserve(static_cast<size_t>(image.width) * 6);
+		for (int c = 2; c >= 0; c--) // B, G, R
+			for (int i = 0; i < image.width; i++)
+				EXRWriter::put<uint16_t>(raw, EXRWriter::toHalf(static_cast<float>(image.at(i, j)[c])));
+		auto packed = EXRWriter::rleCompress(raw);
+		auto& data = packed.size() < raw.size() ? packed : raw; // incompressible lines are stored raw
+
+		std::string chunk;
+		EXRWriter::put<int32_t>(chunk, j);
+		EXRWriter::put<int32_t>(chunk, static_cast<int32_t>(data.size()));
+		chunk += data;
+		return std::vector<char>(chunk.begin(), chunk.end());
+	}
+	/*
+		OpenEXR RLE: interleave the low and high bytes into two halves, delta encode the bytes,
+		then run length encode. count >= 0 => run of count + 1 copies of the next byte,
+		count < 0 => -count literal bytes follow
+	*/
+	static auto rleCompress(const std::string& raw) -> std::string {
+		auto n = raw.size();
+		if (n == 0) return raw;
+		std::string tmp(n, '\0');
+		size_t t1 = 0, t2 = (n + 1) / 2;
+		for (size_t k = 0; k < n; k++)
+			tmp[k % 2 == 0 ? t1++ : t2++] = raw[k];
+		auto p = static_cast<unsigned char>(tmp[0]);
+		for (size_t k = 1; k < n; k++) {
+			auto current = static_cast<unsigned char>(tmp[k]);
+			tmp[k] = static_cast<char>(static_cast<unsigned char>(current - p + 128));
+			p = current;
+		}
+
+		const ptrdiff_t minRun = 3, maxRun = 127;
+		std::string out;
+		out.reserve(n + n / 128 + 1);
+		const char* in = tmp.data();
+		const char* inEnd = in + n;
+		const char* runStart = in;
+		const char* runEnd = in + 1;
+		while (runStart < inEnd) {
+			while (runEnd < inEnd && *runStart == *runEnd && runEnd - runStart - 1 < maxRun)
+				++runEnd;
+			if (runEnd - runStart >= minRun) {
+				out += static_cast<char>((runEnd - runStart) - 1);
+				out += *runStart;
+				runStart = runEnd;
+			}
+			else {
+				while (runEnd < inEnd
+					&& ((runEnd + 1 >= inEnd || *runEnd != *(runEnd + 1)) || (runEnd + 2 >= inEnd || *(runEnd + 1) != *(runEnd + 2)))
+					&& runEnd - runStart < maxRun)
+					++runEnd;
+				out += static_cast<char>(runStart - runEnd);
+				out.append(runStart, runEnd);
+				runStart = runEnd;
+			}
+			++runEnd;
+		}
+		return out;
+	}
+	static auto toHalf(float value) -> uint16_t { // round to nearest even
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = (bits >> 16) & 0x8000;
+		int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+		uint32_t mantissa = bits & 0x7fffff;
+		if (((bits >> 23) & 0xff) == 0xff) // inf, nan
+			return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+		if (exponent >= 31) // too big, inf
+			return static_cast<uint16_t>(sign | 0x7c00);
+		if (exponent <= 0) { // subnormal half (or zero)
+			if (exponent < -10) return static_cast<uint16_t>(sign);
+			mantissa |= 0x800000;
+			auto shift = static_cast<uint32_t>(14 - exponent);
+			uint32_t half = mantissa >> shift;
+			uint32_t remainder = mantissa & ((1u << shift) - 1);
+			uint32_t halfway = 1u << (shift - 1);
+			if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+			return static_cast<uint16_t>(sign | half);
+		}
+		uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+		uint32_t remainder = mantissa & 0x1fff;
+		if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) half++; // a carry rolls into the exponent, which is still correct
+		return static_cast<uint16_t>(half);
+	}
+};
+
+/*
+	Pick a writer from the file extension, .pfm and .exr keep HDR data, anything else is written as binary PPM.
+*/
+inline auto imageWriterFor(const std::string& path) -> shared_ptr<ImageWriter> {
+	auto endsWith = [&path](const std::string& extension) {
+		return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+	};
+	if (endsWith(".pfm")) return make_shared<PFMWriter>();
+	if (endsWith(".exr")) return make_shared<EXRWriter>();
+	return make_shared<PPMWriter>();
+}
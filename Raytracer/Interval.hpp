@@ -1,39 +1,49 @@
 #pragma once
 
-struct Interval {
-	double min, max;
+#include <cmath>
+#include <type_traits>
 
-	Interval() : min(+infinity), max(-infinity) {} // default interval is empty (infinity only defined because of where this is included)
-	Interval(double _min, double _max) : min(_min), max(_max) {}
-	Interval(const Interval& a, const Interval& b) : min{ fmin(a.min, b.min) }, max{ fmax(a.max, b.max) } {}
-	auto contains(double x) const -> bool {
+template <typename T>
+struct IntervalT {
+	T min, max;
+
+	IntervalT() : min(+infinity), max(-infinity) {} // default interval is empty (infinity only defined because of where this is included)
+	IntervalT(T _min, T _max) : min(_min), max(_max) {}
+	IntervalT(const IntervalT& a, const IntervalT& b) : min{ std::fmin(a.min, b.min) }, max{ std::fmax(a.max, b.max) } {}
+	auto contains(T x) const -> bool {
 		return min <= x && x <= max;
 	}
-	auto surrounds(double x) const -> bool {
+	auto surrounds(T x) const -> bool {
 		return min < x && x < max;
 	}
-	auto clamp(double x) const -> double {
+	auto clamp(T x) const -> T {
 		if (x < this->min) return this->min;
 		if (x > this->max) return this->max;
 		return x;
 	}
-	auto size() const -> double {
+	auto size() const -> T {
 		return max - min;
 	}
-	auto expand(double delta) const -> Interval {
+	auto expand(T delta) const -> IntervalT {
 		auto padding = delta / 2;
-		return Interval(min - padding, max + padding);
+		return IntervalT(min - padding, max + padding);
 	}
 
-	static const Interval empty, universe;
+	static const IntervalT empty, universe;
 };
 
-const Interval Interval::empty(+infinity, -infinity);
-const Interval Interval::universe(-infinity, +infinity);
+template <typename T>
+const IntervalT<T> IntervalT<T>::empty(+infinity, -infinity);
+template <typename T>
+const IntervalT<T> IntervalT<T>::universe(-infinity, +infinity);
+
+using Interval = IntervalT<Real>;
 
-auto operator+(const Interval& ival, double displacement) -> Interval {
-	return Interval(ival.min + displacement, ival.max + displacement);
+template <typename T>
+auto operator+(const IntervalT<T>& ival, std::type_identity_t<T> displacement) -> IntervalT<T> {
+	return IntervalT<T>(ival.min + displacement, ival.max + displacement);
 }
-auto operator+(double displacement, const Interval& ival) -> Interval {
+template <typename T>
+auto operator+(std::type_identity_t<T> displacement, const IntervalT<T>& ival) -> IntervalT<T> {
 	return ival + displacement;
 }
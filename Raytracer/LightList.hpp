@@ -0,0 +1,334 @@
+#pragma once
+
+#include "common.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
+#include "LightTree.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+/*
+	The scene's lights (DiffuseLight Quads, Triangles, mesh triangles and Spheres, alone or in a SphereSet),
+	copied out of the scene in world space so paths can aim at them instead of waiting for a bounce to hit
+	one (next event estimation).
+	sample picks a light for a shading point, then a point on it: uniformly over a quad's or triangle's
+	area, uniformly over the cone of directions a sphere fills (all of its area from inside it). The pdf
+	comes back over solid angle, to weigh against the material's own scatteringPdf.
+	Lights are picked with a LightTree, in proportion to a guess at how much each lights the point, so
+	among thousands of lights the few that matter get the samples. Without the tree (gather's buildTree)
+	every light is as likely as any other.
+	A path's own bounce can hit a light too, pdf(origin, normal, rec) says how likely sample was to have
+	picked that same point, 0 for anything not in the list. Lights are told apart by the primitive and
+	the Instances the hit came through (HitRecord::object, primitive and instances), so one light
+	instanced twice is two lights.
+	Left out, and so only ever found by bounces: lights on other shapes, spheres under a transform that
+	does not keep them spheres, and anything nested deeper in Instances than a HitRecord can note.
+*/
+class LightList {
+	enum class Shape : uint8_t { Quad, Triangle, Sphere };
+	struct Light {
+		Shape shape;
+		MaterialHandle material;
+		uint32_t primitive;		// as a hit on it would note it
+		uint32_t transform;		// its toObject in transforms
+		const Hittable* object;
+		Point3 corner;			// quad, triangle: Q, sphere: center at time 0
+		Vec3 edgeU, edgeV;		// quad, triangle: the sides from Q
+		Vec3 normal;			// quad, triangle
+		Vec3 motion;			// sphere: center(time) = corner + time * motion
+		Real area;				// quad, triangle
+		Real radius;			// sphere
+
+		auto center(Real time) const -> Point3 { return this->corner + time * this->motion; }
+	};
+	// a light's primitive and the instances it is reached through, innermost first, as a hit on it records them
+	struct Key {
+		const Hittable* object;
+		uint32_t primitive;
+		uint32_t depth;
+		const Instance* instances[HitRecord::maxInstanceDepth];
+
+		auto operator==(const Key& other) const -> bool {
+			if (this->object != other.object || this->primitive != other.primitive || this->depth != other.depth) return false;
+			return std::equal(this->instances, this->instances + this->depth, other.instances);
+		}
+	};
+	struct KeyHash {
+		auto operator()(const Key& key) const -> size_t {
+			auto h = std::hash<const void*>()(key.object) * 0x9E3779B97F4A7C15ull + key.primitive;
+			for (uint32_t i = 0; i < key.depth; i++)
+				h = h * 0x9E3779B97F4A7C15ull + std::hash<const void*>()(key.instances[i]);
+			return h;
+		}
+	};
+
+	std::vector<Light> lights;
+	std::vector<AffineTransform> transforms;	// the world into each light's object space, one per place lights were gathered from
+	AffineTransform lastToWorld;				// the path transforms.back() was made for
+	std::unordered_map<Key, uint32_t, KeyHash> index;
+	LightTree tree;
+	bool useTree = false;
+	static constexpr int powerGrid = 4; // boundsOf averages the emission of powerGrid x powerGrid points
+
+	static auto keyOf(const Hittable* object, uint32_t primitive, const InstancePath& path) -> Key {
+		Key key{ object, primitive, path.depth, {} };
+		for (uint32_t i = 0; i < path.depth; i++)
+			key.instances[i] = path.instances[path.depth - 1 - i];
+		return key;
+	}
+	// the lights of one mesh or set all come in under the same path, so its inverse is only worked out once
+	auto transformOf(const InstancePath& path) -> uint32_t {
+		if (this->transforms.empty() || std::memcmp(&this->lastToWorld, &path.toWorld, sizeof(AffineTransform)) != 0) {
+			this->transforms.push_back(path.toWorld.inverse());
+			this->lastToWorld = path.toWorld;
+		}
+		return static_cast<uint32_t>(this->transforms.size() - 1);
+	}
+	auto add(const Key& key, const InstancePath& path, Light light) -> void {
+		if (!this->index.try_emplace(key, static_cast<uint32_t>(this->lights.size())).second) return; // same object listed twice
+		light.transform = this->transformOf(path);
+		this->lights.push_back(light);
+	}
+	auto addPlanar(Shape shape, const Hittable* object, uint32_t primitive, const InstancePath& path, const Point3& Q, const Vec3& u, const Vec3& v, MaterialHandle material) -> void {
+		if (!LightList::emits(material)) return;
+		Light light{};
+		light.shape = shape;
+		light.material = material;
+		light.primitive = primitive;
+		light.object = object;
+		light.corner = path.toWorld.point(Q);
+		light.edgeU = path.toWorld.vector(u);
+		light.edgeV = path.toWorld.vector(v);
+		auto n = cross(light.edgeU, light.edgeV);
+		auto length = n.length();
+		if (length == 0) return;
+		light.normal = n / length;
+		light.area = shape == Shape::Triangle ? length / 2 : length;
+		this->add(LightList::keyOf(object, primitive, path), path, light);
+	}
+	static auto planarPdf(const Light& light, const Point3& origin, const Point3& p) -> Real {
+		auto toLight = p - origin;
+		auto distanceSquared = toLight.lengthSquared();
+		auto cosine = std::abs(dot(light.normal, toLight)) / sqrt(distanceSquared);
+		if (cosine < 1e-8) return 0;
+		return distanceSquared / (cosine * light.area);
+	}
+	// density over solid angle of the directions the cone sampling picks, or of uniform area sampling from inside
+	static auto spherePdf(const Light& light, const Point3& origin, const Point3& p, Real time) -> Real {
+		auto center = light.center(time);
+		auto distanceSquared = (center - origin).lengthSquared();
+		auto radiusSquared = light.radius * light.radius;
+		if (distanceSquared <= radiusSquared) {
+			auto toLight = p - origin;
+			auto cosine = std::abs(dot((p - center) / light.radius, toLight)) / toLight.length();
+			if (cosine < 1e-8) return 0;
+			return toLight.lengthSquared() / (cosine * 4 * pi * radiusSquared);
+		}
+		return 1 / (2 * pi * LightList::coneHeight(radiusSquared / distanceSquared));
+	}
+	static auto coneHeight(Real sinSquared) -> Real { // 1 - cos(theta max), without the cancellation for small cones
+		return sinSquared / (1 + sqrt(std::max(Real(0), 1 - sinSquared)));
+	}
+	// a point r1, r2 put uniformly over the light's area (the sphere's at time), with rec set up as a hit there
+	static auto surfacePoint(const Light& light, Real r1, Real r2, Real time, HitRecord& rec) -> Point3 {
+		rec.setHit(1, light.object, light.primitive);
+		if (light.shape == Shape::Quad) {
+			rec.u = r1;
+			rec.v = r2;
+			return light.corner + r1 * light.edgeU + r2 * light.edgeV;
+		}
+		if (light.shape == Shape::Triangle) { // the square root folds the unit square onto the triangle evenly
+			auto root = sqrt(r1);
+			rec.u = root * (1 - r2);
+			rec.v = root * r2;
+			return light.corner + rec.u * light.edgeU + rec.v * light.edgeV;
+		}
+		auto z = 1 - 2 * r1;
+		auto ring = sqrt(std::max(Real(0), 1 - z * z));
+		auto phi = 2 * pi * r2;
+		return light.center(time) + light.radius * Vec3(ring * cos(phi), ring * sin(phi), z);
+	}
+	// what the light emits at p toward origin, its object finishing rec (set up as surfacePoint does) in its own space
+	// as for a ray from origin reaching p at t = 1
+	auto emission(const Light& light, const Point3& origin, const Point3& p, Real time, HitRecord& rec) const -> Color {
+		const auto& toObject = this->transforms[light.transform];
+		light.object->finalize(Ray(toObject.point(origin), toObject.vector(p - origin), time, nullptr), rec);
+		return sceneMaterials[light.material].emitted(rec.u, rec.v, p);
+	}
+	/*
+		What the tree knows of a light. Its power is a guess from the emission averaged over a grid of points
+		spread evenly over it, so a textured light is judged by all of its texture rather than one spot, times
+		its area and pi (a diffuse emitter's radiance over the hemisphere), counting both sides of a quad or
+		triangle, which DiffuseLight lights alike.
+	*/
+	auto boundsOf(const Light& light) const -> LightBounds {
+		LightBounds bounds;
+		Real area;
+		if (light.shape == Shape::Sphere) {
+			auto r = Vec3(light.radius, light.radius, light.radius);
+			auto center2 = light.center(1);
+			bounds.box = AxisAlignedBoundingBox(
+				AxisAlignedBoundingBox(light.corner - r, light.corner + r), AxisAlignedBoundingBox(center2 - r, center2 + r)
+			);
+			bounds.cosSpread = -1; // normals every way
+			area = 4 * pi * light.radius * light.radius;
+		}
+		else {
+			auto far = light.shape == Shape::Quad ? light.corner + light.edgeU + light.edgeV : light.corner;
+			bounds.box = AxisAlignedBoundingBox(
+				AxisAlignedBoundingBox(light.corner, far),
+				AxisAlignedBoundingBox(light.corner + light.edgeU, light.corner + light.edgeV)
+			);
+			bounds.axis = light.normal;
+			bounds.twoSided = true;
+			area = 2 * light.area;
+		}
+		Color emitted(0, 0, 0);
+		for (int i = 0; i < powerGrid; i++) {
+			for (int j = 0; j < powerGrid; j++) {
+				HitRecord rec;
+				auto p = LightList::surfacePoint(light, (i + Real(0.5)) / powerGrid, (j + Real(0.5)) / powerGrid, 0, rec);
+				auto outward = light.shape == Shape::Sphere ? p - light.corner : light.normal;
+				emitted += this->emission(light, p + outward, p, 0, rec);
+			}
+		}
+		emitted /= powerGrid * powerGrid;
+		bounds.power = std::max(Real(0), (emitted.x() + emitted.y() + emitted.z()) / 3) * area * pi;
+		return bounds;
+	}
+	// which light sample takes for origin, and its probability
+	auto choose(const Point3& origin, const Vec3& normal, double u, uint32_t& light, Real& probability) const -> bool {
+		if (this->useTree) return this->tree.sample(origin, normal, u, light, probability);
+		auto count = this->lights.size();
+		light = static_cast<uint32_t>(std::min(static_cast<size_t>(u * count), count - 1));
+		probability = Real(1) / count;
+		return true;
+	}
+
+public:
+	/*
+		what sample hands back: the way to the chosen point (toLight, unnormalized, the point is origin + toLight),
+		the light's normal there (either side, for stepping the shadow ray off it), its light and the pdf
+	*/
+	struct Sample {
+		Vec3 toLight;
+		Vec3 normal;
+		Color radiance;
+		Real pdf;
+	};
+
+	// everything in world sample can aim at, picked among with a LightTree when buildTree, uniformly otherwise
+	auto gather(const Hittable& world, bool buildTree = true) -> void {
+		this->lights.clear();
+		this->transforms.clear();
+		this->index.clear();
+		world.gatherLights(*this, InstancePath());
+		this->useTree = buildTree && this->lights.size() > 1;
+		std::vector<LightBounds> bounds;
+		if (this->useTree) {
+			bounds.resize(this->lights.size());
+			for (size_t i = 0; i < this->lights.size(); i++)
+				bounds[i] = this->boundsOf(this->lights[i]);
+		}
+		this->tree.build(bounds);
+	}
+	// whether a primitive made of material is one sample can aim at, for sets to skip their other primitives all at once
+	static auto emits(MaterialHandle material) -> bool {
+		return sceneMaterials[material].kind() == MaterialKind::DiffuseLight;
+	}
+	auto addQuad(const Hittable* object, uint32_t primitive, const InstancePath& path, const Point3& Q, const Vec3& u, const Vec3& v, MaterialHandle material) -> void {
+		this->addPlanar(Shape::Quad, object, primitive, path, Q, u, v, material);
+	}
+	// triangle Q, Q + u, Q + v, whose object's finalize takes the barycentrics of u and v as rec.u and rec.v
+	auto addTriangle(const Hittable* object, uint32_t primitive, const InstancePath& path, const Point3& Q, const Vec3& u, const Vec3& v, MaterialHandle material) -> void {
+		this->addPlanar(Shape::Triangle, object, primitive, path, Q, u, v, material);
+	}
+	auto addSphere(const Hittable* object, uint32_t primitive, const InstancePath& path, const Point3& center1, const Vec3& motion, Real radius, MaterialHandle material) -> void {
+		if (radius == 0 || !LightList::emits(material)) return;
+		auto scale = path.toWorld.uniformScale();
+		if (scale == 0) return; // squashed into an ellipsoid
+		Light light{};
+		light.shape = Shape::Sphere;
+		light.material = material;
+		light.primitive = primitive;
+		light.object = object;
+		light.corner = path.toWorld.point(center1);
+		light.motion = path.toWorld.vector(motion);
+		light.radius = std::abs(radius) * scale;
+		this->add(LightList::keyOf(object, primitive, path), path, light);
+	}
+	auto empty() const -> bool { return this->lights.empty(); }
+	auto size() const -> size_t { return this->lights.size(); }
+	auto treeNodes() const -> size_t { return this->useTree ? this->tree.nodeCount() : 0; }
+
+	/*
+		Pick a light and a point on it for a shading point at origin facing normal (zero in a volume),
+		false if there is none to pick (or none can light origin, or the pick lands edge on).
+	*/
+	auto sample(const Point3& origin, const Vec3& normal, Real time, Sampler& sampler, Sample& s) const -> bool {
+		if (this->lights.empty()) return false;
+		uint32_t chosen;
+		Real probability;
+		if (!this->choose(origin, normal, sampler.next(), chosen, probability))
+			return false;
+		const auto& light = this->lights[chosen];
+		auto r1 = static_cast<Real>(sampler.next());
+		auto r2 = static_cast<Real>(sampler.next());
+		Point3 p;
+		HitRecord rec; // the point as a hit on the light, for its object to work out the texture coordinates
+		if (light.shape != Shape::Sphere) {
+			p = LightList::surfacePoint(light, r1, r2, time, rec);
+			s.pdf = LightList::planarPdf(light, origin, p);
+		}
+		else {
+			auto center = light.center(time);
+			auto toCenter = center - origin;
+			auto distanceSquared = toCenter.lengthSquared();
+			auto radiusSquared = light.radius * light.radius;
+			if (distanceSquared <= radiusSquared) // inside, any point of it is in view
+				p = LightList::surfacePoint(light, r1, r2, time, rec);
+			else { // direction in the cone around toCenter, then where it meets the sphere
+				rec.setHit(1, light.object, light.primitive);
+				auto height = r1 * LightList::coneHeight(radiusSquared / distanceSquared); // 1 - cos(theta)
+				auto sinTheta = sqrt(std::max(Real(0), height * (2 - height)));
+				auto phi = 2 * pi * r2;
+				auto w = toCenter / sqrt(distanceSquared);
+				auto a = std::abs(w.x()) > 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+				auto side = unitVector(cross(w, a));
+				auto up = cross(w, side);
+				auto direction = sinTheta * cos(phi) * side + sinTheta * sin(phi) * up + (1 - height) * w;
+				auto oc = origin - center;
+				auto halfB = dot(oc, direction);
+				auto underRadical = std::max(Real(0), halfB * halfB - (oc.lengthSquared() - radiusSquared)); // grazing directions round either way
+				p = origin + (-halfB - sqrt(underRadical)) * direction;
+			}
+			s.pdf = LightList::spherePdf(light, origin, p, time);
+		}
+		if (s.pdf <= 0) return false;
+		s.pdf *= probability;
+		s.toLight = p - origin;
+		s.normal = light.shape == Shape::Sphere ? (p - light.center(time)) / light.radius : light.normal;
+		s.radiance = this->emission(light, origin, p, time, rec);
+		return true;
+	}
+	/*
+		Density over solid angle with which sample, from origin facing normal, picks the point a hit on a
+		light (rec) landed on
+	*/
+	auto pdf(const Point3& origin, const Vec3& normal, const HitRecord& rec, Real time) const -> Real {
+		if (this->lights.empty() || !rec.object) return 0;
+		Key key{ rec.object, rec.primitive, rec.instanceDepth, {} };
+		std::copy(rec.instances, rec.instances + rec.instanceDepth, key.instances);
+		auto found = this->index.find(key);
+		if (found == this->index.end()) return 0;
+		const auto& light = this->lights[found->second];
+		auto probability = this->useTree ? this->tree.pdf(origin, normal, found->second) : Real(1) / this->lights.size();
+		if (probability <= 0) return 0;
+		auto pdf = light.shape == Shape::Sphere ? LightList::spherePdf(light, origin, rec.p, time) : LightList::planarPdf(light, origin, rec.p);
+		return pdf * probability;
+	}
+};
@@ -0,0 +1,331 @@
+#pragma once
+
+#include "common.hpp"
+#include "AxisAlignedBoundingBox.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+	What a light tree knows about a group of lights: where they are (box), how much light they give off
+	all told (power), which way they face and how wide they shine (an orientation cone, after Conty and
+	Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting", 2018).
+	Every normal of the group lies within acos(cosSpread) of axis, and every point sends its light out
+	within acos(cosEmission) of its normal, 0 for a diffuse emitter's whole hemisphere. Two sided groups
+	shine on both sides of their normals.
+*/
+struct LightBounds {
+	AxisAlignedBoundingBox box;
+	Vec3 axis = Vec3(0, 0, 1);
+	Real cosSpread = 1;
+	Real cosEmission = 0;
+	Real power = 0;
+	bool twoSided = false;
+
+	// bounds of both groups together
+	static auto merge(const LightBounds& a, const LightBounds& b) -> LightBounds {
+		if (a.power <= 0) return b; // lights that give off nothing never get picked, so where they are doesn't matter
+		if (b.power <= 0) return a;
+		LightBounds merged;
+		merged.box = AxisAlignedBoundingBox(a.box, b.box);
+		LightBounds::mergeCones(a, b, merged.axis, merged.cosSpread);
+		merged.cosEmission = std::min(a.cosEmission, b.cosEmission);
+		merged.power = a.power + b.power;
+		merged.twoSided = a.twoSided || b.twoSided;
+		return merged;
+	}
+
+private:
+	/*
+		Smallest cone around both: if neither holds the other, its axis lies in the plane of the two axes,
+		turned from a's toward b's so that its half angle (a's + the angle between the axes + b's) / 2 just
+		reaches the far edge of each.
+	*/
+	static auto mergeCones(const LightBounds& a, const LightBounds& b, Vec3& axis, Real& cosSpread) -> void {
+		auto angleA = acos(std::clamp(a.cosSpread, Real(-1), Real(1)));
+		auto angleB = acos(std::clamp(b.cosSpread, Real(-1), Real(1)));
+		auto between = acos(std::clamp(dot(a.axis, b.axis), Real(-1), Real(1)));
+		if (std::min(between + angleB, Real(pi)) <= angleA) {
+			axis = a.axis;
+			cosSpread = a.cosSpread;
+			return;
+		}
+		if (std::min(between + angleA, Real(pi)) <= angleB) {
+			axis = b.axis;
+			cosSpread = b.cosSpread;
+			return;
+		}
+		auto angle = (angleA + between + angleB) / 2;
+		auto turn = cross(a.axis, b.axis);
+		if (angle >= pi || turn.lengthSquared() == 0) { // every direction
+			axis = a.axis;
+			cosSpread = -1;
+			return;
+		}
+		// turning a's axis by angle - angleA about turn (Rodrigues, turn is perpendicular to it) toward b's
+		auto toward = cross(unitVector(turn), a.axis);
+		axis = unitVector(cos(angle - angleA) * a.axis + sin(angle - angleA) * toward);
+		cosSpread = cos(angle);
+	}
+};
+
+/*
+	Binary tree over a scene's lights for picking one in proportion to how much it is likely to light a
+	given point, in log time whatever the number of lights. Every node holds the LightBounds of the lights
+	under it and every leaf one light. Picking walks down from the root, at each node going into one
+	child or the other in proportion to their importance for the point, with the one random number
+	rescaled at every step. The probability of the light it ends at is the product of the choices.
+	A path's bounce can hit a light by itself, and weighing that needs the probability the walk would
+	have picked it: every light keeps the turns from the root down to it as bits (trail), so pdf retraces
+	exactly the walk sample would take.
+	Splits are chosen like the geometry BVH's, binned along each axis, but with a cost that also weighs
+	power and how spread out the lights' orientations are (the surface area orientation heuristic), so
+	bright lights and lights facing the same way stay together.
+*/
+class LightTree {
+	/*
+		A node's LightBounds, kept the way importance uses them: the box as its bounding sphere, the spread
+		as cosine and sine. A node's first child directly follows it, depth first.
+	*/
+	struct Node {
+		Point3 center;
+		Real radius;
+		Vec3 axis;
+		Real cosSpread, sinSpread;
+		Real cosEmission;
+		Real power;
+		uint32_t second;	// interior: index of the second child, leaf: the light
+		bool twoSided;
+		bool leaf;
+
+		Node() = default;
+		Node(const LightBounds& bounds, uint32_t second, bool leaf) :
+			center(bounds.box.centroid()), axis(bounds.axis), cosSpread(bounds.cosSpread), cosEmission(bounds.cosEmission),
+			power(bounds.power), second(second), twoSided(bounds.twoSided), leaf(leaf)
+		{
+			auto diagonal = Vec3(bounds.box.x.size(), bounds.box.y.size(), bounds.box.z.size());
+			this->radius = bounds.power > 0 ? diagonal.length() / 2 : 0;
+			this->sinSpread = sqrt(std::max(Real(0), 1 - this->cosSpread * this->cosSpread));
+		}
+		/*
+			Guess at how much of the node's light reaches p on a surface facing n (a zero n for a point in a
+			volume, which takes light from every side): power over distance squared, times the cosine of the
+			smallest angle any of its lights could be facing p at, times the same for the surface.
+			The angles are bounded from the bounding sphere, seen from p, and the cone, so the guess is only
+			ever 0 when none of the lights can light p.
+		*/
+		auto importance(const Point3& p, const Vec3& n) const -> Real {
+			if (this->power <= 0) return 0;
+			auto toPoint = p - this->center;
+			auto distanceSquared = toPoint.lengthSquared();
+			auto radiusSquared = this->radius * this->radius;
+			if (distanceSquared <= radiusSquared) // inside the sphere every angle is possible, only the distance is capped
+				return this->power / std::max(radiusSquared, Real(1e-12));
+			auto inverseDistance = 1 / sqrt(distanceSquared);
+			auto toPointDirection = toPoint * inverseDistance;
+			// the angle the sphere spans around its center as seen from p
+			auto sinBox = this->radius * inverseDistance;
+			auto cosBox = sqrt(1 - sinBox * sinBox);
+			auto cosToPoint = dot(this->axis, toPointDirection);
+			if (this->twoSided) cosToPoint = std::abs(cosToPoint);
+			// smallest angle between a normal and the way to p: the axis's angle, less the spread, less the sphere
+			Real cosFacing, sinFacing;
+			Node::subtractAngles(cosToPoint, sqrt(std::max(Real(0), 1 - cosToPoint * cosToPoint)), this->cosSpread, this->sinSpread, cosFacing, sinFacing);
+			Node::subtractAngles(cosFacing, sinFacing, cosBox, sinBox, cosFacing, sinFacing);
+			if (cosFacing <= this->cosEmission) return 0;
+			auto importance = this->power * cosFacing / distanceSquared;
+			if (n.x() != 0 || n.y() != 0 || n.z() != 0) {
+				auto cosIncoming = -dot(n, toPointDirection);
+				Real cosReceiving, sinReceiving;
+				Node::subtractAngles(cosIncoming, sqrt(std::max(Real(0), 1 - cosIncoming * cosIncoming)), cosBox, sinBox, cosReceiving, sinReceiving);
+				if (cosReceiving <= 0) return 0; // all of it behind the surface
+				importance *= cosReceiving;
+			}
+			return importance;
+		}
+		// cos and sin of max(0, A - B), from those of A and B
+		static auto subtractAngles(Real cosA, Real sinA, Real cosB, Real sinB, Real& cosOut, Real& sinOut) -> void {
+			if (cosA > cosB) { // A < B
+				cosOut = 1;
+				sinOut = 0;
+				return;
+			}
+			auto c = cosA * cosB + sinA * sinB;
+			auto s = sinA * cosB - cosA * sinB;
+			cosOut = c;
+			sinOut = s;
+		}
+	};
+	struct BuildLight {
+		LightBounds bounds;
+		Point3 centroid;
+		uint32_t light;
+	};
+	static constexpr int binCount = 12;
+	static constexpr int maxCostedDepth = 32; // deeper than this splits in half, so no trail grows past 64 turns
+
+	std::vector<Node> nodes;
+	std::vector<uint64_t> trails; // per light, bit d set when the walk takes the second child at depth d
+
+	/*
+		Orientation measure of a cone of normals spreading acos(cosSpread), each shining acos(cosEmission) wide:
+		the solid angle the light can leave in, weighted by cosine toward the edge of the emission
+	*/
+	static auto orientationMeasure(const LightBounds& b) -> Real {
+		auto spread = acos(std::clamp(b.cosSpread, Real(-1), Real(1)));
+		auto emission = acos(std::clamp(b.cosEmission, Real(-1), Real(1)));
+		auto reach = std::min(spread + emission, Real(pi));
+		auto sinSpread = sqrt(std::max(Real(0), 1 - b.cosSpread * b.cosSpread));
+		return 2 * pi * (1 - b.cosSpread)
+			+ pi / 2 * (2 * reach * sinSpread - cos(spread - 2 * reach) - 2 * spread * sinSpread + b.cosSpread);
+	}
+	// regularizer: a split across a thin axis of a long box costs more
+	static auto splitCost(const LightBounds& b, Real stretch) -> Real {
+		return b.power * LightTree::orientationMeasure(b) * stretch * b.box.surfaceArea();
+	}
+
+	auto buildSubtree(std::vector<BuildLight>& lights, size_t begin, size_t end, uint64_t trail, int depth) -> LightBounds {
+		auto index = static_cast<uint32_t>(this->nodes.size());
+		this->nodes.emplace_back();
+		if (end - begin == 1) {
+			this->nodes[index] = Node(lights[begin].bounds, lights[begin].light, true);
+			this->trails[lights[begin].light] = trail;
+			return lights[begin].bounds;
+		}
+		LightBounds all;
+		AxisAlignedBoundingBox centroids;
+		for (auto i = begin; i < end; i++) {
+			all = LightBounds::merge(all, lights[i].bounds);
+			centroids = AxisAlignedBoundingBox(centroids, AxisAlignedBoundingBox(lights[i].centroid, lights[i].centroid));
+		}
+		auto middle = begin;
+		if (depth < maxCostedDepth)
+			middle = LightTree::costedSplit(lights, begin, end, all, centroids);
+		if (middle == begin) { // nothing to tell them apart by (or too deep), split in half along the widest axis
+			int axis = 0;
+			for (int a = 1; a < 3; a++)
+				if (centroids.axis(a).size() > centroids.axis(axis).size()) axis = a;
+			middle = begin + (end - begin) / 2;
+			std::nth_element(lights.begin() + begin, lights.begin() + middle, lights.begin() + end,
+				[axis](const BuildLight& a, const BuildLight& b) { return a.centroid[axis] < b.centroid[axis]; });
+		}
+		auto first = this->buildSubtree(lights, begin, middle, trail, depth + 1);
+		auto secondIndex = static_cast<uint32_t>(this->nodes.size());
+		auto second = this->buildSubtree(lights, middle, end, trail | (uint64_t(1) << depth), depth + 1);
+		auto bounds = LightBounds::merge(first, second);
+		this->nodes[index] = Node(bounds, secondIndex, false);
+		return bounds;
+	}
+	// partition [begin, end) at the cheapest plane between bins and return where the second half starts, begin if there is none
+	static auto costedSplit(std::vector<BuildLight>& lights, size_t begin, size_t end, const LightBounds& all, const AxisAlignedBoundingBox& centroids) -> size_t {
+		auto longest = std::max({ all.box.x.size(), all.box.y.size(), all.box.z.size() });
+		auto binOf = [&](const BuildLight& light, int axis) {
+			const auto& extent = centroids.axis(axis);
+			auto bin = static_cast<int>(binCount * ((light.centroid[axis] - extent.min) / extent.size()));
+			return std::clamp(bin, 0, binCount - 1);
+		};
+		Real bestCost = infinity;
+		int bestAxis = -1, bestPlane = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			if (centroids.axis(axis).size() <= 0) continue;
+			LightBounds bins[binCount];
+			for (auto i = begin; i < end; i++) {
+				auto& bin = bins[binOf(lights[i], axis)];
+				bin = LightBounds::merge(bin, lights[i].bounds);
+			}
+			auto stretch = all.box.axis(axis).size() > 0 ? longest / all.box.axis(axis).size() : Real(1);
+			LightBounds right[binCount];
+			right[binCount - 1] = bins[binCount - 1];
+			for (int b = binCount - 2; b > 0; b--)
+				right[b] = LightBounds::merge(right[b + 1], bins[b]);
+			LightBounds left;
+			for (int plane = 1; plane < binCount; plane++) { // plane p puts bins [0, p) on the left
+				left = LightBounds::merge(left, bins[plane - 1]);
+				auto cost = LightTree::splitCost(left, stretch) + LightTree::splitCost(right[plane], stretch);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestPlane = plane;
+				}
+			}
+		}
+		if (bestAxis < 0) return begin;
+		auto middle = std::partition(lights.begin() + begin, lights.begin() + end,
+			[&](const BuildLight& light) { return binOf(light, bestAxis) < bestPlane; });
+		auto split = static_cast<size_t>(middle - lights.begin());
+		return split == end ? begin : split;
+	}
+	// probability of taking the first child of interior node index, false when neither child can light p
+	auto firstChance(uint32_t index, const Point3& p, const Vec3& n, double& chance) const -> bool {
+		auto first = this->nodes[index + 1].importance(p, n);
+		auto second = this->nodes[this->nodes[index].second].importance(p, n);
+		if (first + second <= 0) return false;
+		chance = static_cast<double>(first) / (static_cast<double>(first) + second);
+		return true;
+	}
+
+public:
+	// tree over lights, light i being the i-th bounds
+	auto build(const std::vector<LightBounds>& bounds) -> void {
+		this->nodes.clear();
+		this->trails.assign(bounds.size(), 0);
+		if (bounds.empty()) return;
+		std::vector<BuildLight> lights(bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++)
+			lights[i] = BuildLight{ bounds[i], bounds[i].box.centroid(), static_cast<uint32_t>(i) };
+		this->nodes.reserve(2 * bounds.size() - 1);
+		this->buildSubtree(lights, 0, lights.size(), 0, 0);
+	}
+	auto nodeCount() const -> size_t { return this->nodes.size(); }
+
+	/*
+		Pick a light for p (facing n, see Node::importance) with u in [0, 1): the light and the
+		probability it had, false when no light can reach p
+	*/
+	auto sample(const Point3& p, const Vec3& n, double u, uint32_t& light, Real& probability) const -> bool {
+		if (this->nodes.empty() || this->nodes[0].importance(p, n) <= 0) return false;
+		static const double belowOne = std::nextafter(1.0, 0.0);
+		double chance = 1;
+		uint32_t index = 0;
+		while (!this->nodes[index].leaf) {
+			double first;
+			if (!this->firstChance(index, p, n, first)) return false;
+			if (u < first) {
+				u = std::min(u / first, belowOne);
+				chance *= first;
+				index = index + 1;
+			}
+			else {
+				u = std::min((u - first) / (1 - first), belowOne);
+				chance *= 1 - first;
+				index = this->nodes[index].second;
+			}
+		}
+		light = this->nodes[index].second;
+		probability = static_cast<Real>(chance);
+		return true;
+	}
+	// probability sample picks light for p, retracing its walk
+	auto pdf(const Point3& p, const Vec3& n, uint32_t light) const -> Real {
+		if (this->nodes.empty() || this->nodes[0].importance(p, n) <= 0) return 0;
+		auto trail = this->trails[light];
+		double chance = 1;
+		uint32_t index = 0;
+		while (!this->nodes[index].leaf) {
+			double first;
+			if (!this->firstChance(index, p, n, first)) return 0;
+			if (trail & 1) {
+				chance *= 1 - first;
+				index = this->nodes[index].second;
+			}
+			else {
+				chance *= first;
+				index = index + 1;
+			}
+			trail >>= 1;
+		}
+		return static_cast<Real>(chance);
+	}
+};
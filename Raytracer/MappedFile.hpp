@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+	A whole file mapped read only into memory. The pages are the OS's page cache, only read from disk
+	when first touched, so opening a large file costs next to nothing and two processes mapping the same
+	file share one copy of it. The mapping starts on a page boundary, so anything stored in the file at
+	an offset aligned for its type can be used in place.
+	Stays mapped until the MappedFile is destroyed, whatever points into it must not outlive it.
+*/
+class MappedFile {
+	const std::byte* bytes = nullptr;
+	size_t length = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+	auto close() -> void {
+#if defined(_WIN32)
+		if (this->bytes) UnmapViewOfFile(this->bytes);
+		if (this->mapping) CloseHandle(this->mapping);
+		if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+		this->mapping = nullptr;
+		this->file = INVALID_HANDLE_VALUE;
+#else
+		if (this->bytes) munmap(const_cast<std::byte*>(this->bytes), this->length);
+#endif
+		this->bytes = nullptr;
+		this->length = 0;
+	}
+
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	auto operator=(const MappedFile&) -> MappedFile& = delete;
+	~MappedFile() { this->close(); }
+
+	/*
+		Map path, false when it can't be. An empty file opens fine with no data.
+		Quiet about a file that isn't there, callers treat that as a cache miss rather than an error.
+	*/
+	auto open(const std::string& path) -> bool {
+		this->close();
+#if defined(_WIN32)
+		this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (this->file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(this->file, &size)) {
+			std::cerr << "ERROR: Could not get the size of '" << path << "'.\n";
+			this->close();
+			return false;
+		}
+		if (size.QuadPart == 0) return true;
+		this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		auto view = this->mapping ? MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!view) {
+			std::cerr << "ERROR: Could not map '" << path << "'.\n";
+			this->close();
+			return false;
+		}
+		this->bytes = static_cast<const std::byte*>(view);
+		this->length = static_cast<size_t>(size.QuadPart);
+#else
+		auto descriptor = ::open(path.c_str(), O_RDONLY);
+		if (descriptor < 0) return false;
+		struct stat status;
+		if (fstat(descriptor, &status) != 0) {
+			std::cerr << "ERROR: Could not get the size of '" << path << "'.\n";
+			::close(descriptor);
+			return false;
+		}
+		if (status.st_size == 0) {
+			::close(descriptor);
+			return true;
+		}
+		auto view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+		::close(descriptor); // the mapping keeps its own reference to the file
+		if (view == MAP_FAILED) {
+			std::cerr << "ERROR: Could not map '" << path << "'.\n";
+			return false;
+		}
+		this->bytes = static_cast<const std::byte*>(view);
+		this->length = static_cast<size_t>(status.st_size);
+#endif
+		return true;
+	}
+	auto data() const -> const std::byte* { return this->bytes; }
+	auto size() const -> size_t { return this->length; }
+};
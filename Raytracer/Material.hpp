@@ -7,12 +7,37 @@ constexpr const bool USE_LAMBERTIAN_DIFFUSE = true;
 
 struct HitRecord; // forward declaration
 
+/*
+	Which scatter implementation a material uses. Lets batches of hits be grouped so that
+	each kind of material is shaded in one run instead of interleaving every type's code
+*/
+enum class MaterialKind : uint8_t {
+	Lambertian,
+	Metal,
+	Dielectric,
+	DiffuseLight,
+	Isotropic,
+	Count
+};
+
 struct Material {
 	virtual ~Material() = default;
-	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const -> bool = 0;
-	virtual auto emitted(double u, double v, const Point3& p) const -> Color {
+	virtual auto kind() const -> MaterialKind = 0;
+	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const -> bool = 0;
+	virtual auto emitted(Real u, Real v, const Point3& p) const -> Color {
 		return Color(0, 0, 0);
 	}
+	/*
+		Density (over solid angle) with which scatter sends rays off in direction. These materials pick
+		directions in exactly the proportion they scatter light into them, so attenuation * scatteringPdf
+		is also how much of the light arriving from direction leaves toward rIn (the BSDF times the cosine),
+		which is what lighting a point by sampling the lights needs.
+		0 for materials that pick their direction out exactly (Metal, Dielectric): light sampling can't
+		reach them and every bit of light they see comes from their own bounce.
+	*/
+	virtual auto scatteringPdf(const Ray& rIn, const HitRecord& rec, const Vec3& direction) const -> Real {
+		return 0;
+	}
 };
 
 // Diffuse Material
@@ -23,60 +48,74 @@ public:
 	Lambertian(const Color& a) : albedo{ make_shared<SolidColor>(a) } {}
 	Lambertian(shared_ptr<Texture> a) : albedo(a) {}
 
-	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const -> bool override {
+	auto kind() const -> MaterialKind override { return MaterialKind::Lambertian; }
+
+	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const -> bool override {
 		Vec3 scatterDir;
 		if constexpr (USE_LAMBERTIAN_DIFFUSE)
-			scatterDir = rec.normal + randomUnitVector();	// Lambertian image 2 unit sphere tangent to the surface. pick sphere
+			scatterDir = rec.normal + randomUnitVector(sampler);	// Lambertian image 2 unit sphere tangent to the surface. pick sphere
 		else												// on same normal side, get random vector that is within, then go from 
-			scatterDir = randomInHemisphere(rec.normal);	// hit point to random vector. else case is no Lambertian
+			scatterDir = randomInHemisphere(rec.normal, sampler);	// hit point to random vector. else case is no Lambertian
 		if (scatterDir.nearZero()) scatterDir = rec.normal; // avoid generating a zero vector
-		scattered = Ray(rec.p, scatterDir, rIn.time());
+		scattered = rec.spawnRay(scatterDir, rIn.time(), &sampler);
 		attenuation = albedo->value(rec.u, rec.v, rec.p);
 		return true;
 	}
+	auto scatteringPdf(const Ray& rIn, const HitRecord& rec, const Vec3& direction) const -> Real override {
+		auto cosine = dot(rec.normal, unitVector(direction));
+		if (cosine <= 0) return 0;
+		if constexpr (USE_LAMBERTIAN_DIFFUSE)
+			return cosine / pi;	// normal + random unit vector is cosine distributed
+		else
+			return 1 / (2 * pi);
+	}
 };
 
 // Metallic Material
 class Metal : public Material {
 	Color albedo;
-	double fuzz;
+	Real fuzz;
 
 public:
-	Metal(const Color& a, double f) : albedo{ a }, fuzz{f < 1 ? f : 1} {}
+	Metal(const Color& a, Real f) : albedo{ a }, fuzz{f < 1 ? f : 1} {}
+
+	auto kind() const -> MaterialKind override { return MaterialKind::Metal; }
 
-	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const -> bool override {
+	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const -> bool override {
 		Vec3 reflected = reflect(unitVector(rIn.direction()), rec.normal);				// metallic rays are reflected
-		scattered = Ray(rec.p, reflected + fuzz * randomInUnitSphere(), rIn.time());	// jiggle a bit to cause increasing fuzziness w/ anti-aliasing
+		scattered = rec.spawnRay(reflected + fuzz * randomInUnitSphere(sampler), rIn.time(), &sampler);	// jiggle a bit to cause increasing fuzziness w/ anti-aliasing
 		attenuation = albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 };
 
 struct Dielectric : public Material {
-	double ir; // index of refraction
+	Real ir; // index of refraction
+
+	Dielectric(Real indexOfRefraction) : ir{ indexOfRefraction } {}
 
-	Dielectric(double indexOfRefraction) : ir{ indexOfRefraction } {}
+	auto kind() const -> MaterialKind override { return MaterialKind::Dielectric; }
 
-	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const -> bool override {
+	virtual auto scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const -> bool override {
 		attenuation = Color(1.0, 1.0, 1.0);
-		double refractionRatio = rec.frontFace ? (1.0 / ir) : ir;
+		Real refractionRatio = rec.frontFace ? (1.0 / ir) : ir;
 		Vec3 unitDir = unitVector(rIn.direction());
 		// if eta2 > eta1 broken inequality
 		// eta2/eta1 * sin theta2 > 1.0 (as sin theta1 cant be bigger than 1).
 		// in these cases, must reflect (total internal reflection)
-		double cosTheta = fmin(dot(-unitDir, rec.normal), 1.0);	// trig R * n = cos theta
-		double sinTheta = sqrt(1.0 - cosTheta * cosTheta);		// trig sin theta = sqrt(1-cos^2(theta))
+		Real cosTheta = fmin(dot(-unitDir, rec.normal), 1.0);	// trig R * n = cos theta
+		Real sinTheta = sqrt(1.0 - cosTheta * cosTheta);		// trig sin theta = sqrt(1-cos^2(theta))
 		bool cannotRefract = refractionRatio * sinTheta > 1.0;
 		Vec3 dir;
-		if (cannotRefract || reflectance(cosTheta, refractionRatio) > randomDouble())
+		if (cannotRefract || reflectance(cosTheta, refractionRatio) > sampler.next())
 			dir = reflect(unitDir, rec.normal);
 		else
 			dir = refract(unitDir, rec.normal, refractionRatio);
-		scattered = Ray(rec.p, dir, rIn.time());
+		scattered = rec.spawnRay(dir, rIn.time(), &sampler);
 		return true;
 	}
 private:
-	static auto reflectance(double cosine, double refractiveIndex) -> double {
+	static auto reflectance(Real cosine, Real refractiveIndex) -> Real {
 		// Schlick's approximation cause real equation is nasty
 		auto r0 = (1 - refractiveIndex) / (1 + refractiveIndex);
 		r0 = r0 * r0;
@@ -91,10 +130,12 @@ public:
 	DiffuseLight(shared_ptr<Texture> a) : emit(a) {}
 	DiffuseLight(Color c) : emit(make_shared<SolidColor>(c)) {}
 
-	auto scatter(const Ray& rIn, const HitRecord& rec, Color& attentuation, Ray& scattered) const -> bool override {
+	auto kind() const -> MaterialKind override { return MaterialKind::DiffuseLight; }
+
+	auto scatter(const Ray& rIn, const HitRecord& rec, Color& attentuation, Ray& scattered, Sampler& sampler) const -> bool override {
 		return false;
 	}
-	auto emitted(double u, double v, const Point3& p) const -> Color override {
+	auto emitted(Real u, Real v, const Point3& p) const -> Color override {
 		return this->emit->value(u, v, p);
 	}
 };
@@ -106,9 +147,14 @@ public:
 	Isotropic(Color c) : albedo(make_shared<SolidColor>(c)) {}
 	Isotropic(shared_ptr<Texture> a) : albedo(a) {}
 
-	auto scatter(const Ray& rIn, const HitRecord& rec, Color& attentuation, Ray& scattered) const -> bool override {
-		scattered = Ray(rec.p, randomUnitVector(), rIn.time());
+	auto kind() const -> MaterialKind override { return MaterialKind::Isotropic; }
+
+	auto scatter(const Ray& rIn, const HitRecord& rec, Color& attentuation, Ray& scattered, Sampler& sampler) const -> bool override {
+		scattered = Ray(rec.p, randomUnitVector(sampler), rIn.time(), &sampler); // inside a volume, no surface to step off
 		attentuation = albedo->value(rec.u, rec.v, rec.p);
 		return true;
 	}
+	auto scatteringPdf(const Ray& rIn, const HitRecord& rec, const Vec3& direction) const -> Real override {
+		return 1 / (4 * pi);
+	}
 };
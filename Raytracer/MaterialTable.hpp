@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct Material; // forward declaration
+
+// index of a material in the scene's MaterialTable
+using MaterialHandle = uint32_t;
+
+/*
+	Every material of the scene in one array. Hit records name their material by index instead of holding
+	a shared_ptr to it, so copying a record is plain bytes rather than an atomic reference count
+	increment and decrement, which every thread did on the same few control blocks.
+	Primitives add their material when they are made and keep the handle, adding the same material again
+	hands back the same handle, and the table keeps every material alive from then on.
+	Adding is for building the scene, looking up for rendering: lookups take no lock, so nothing may be
+	added while a render is running. Camera::render freezes the table for as long as it runs, and adding
+	to (or clearing) a frozen table aborts, in every build. A program that builds one scene after another clears the table once the
+	previous scene's primitives are gone, otherwise its materials stay around.
+*/
+class MaterialTable {
+	std::vector<shared_ptr<Material>> entries;
+	std::unordered_map<const Material*, MaterialHandle> handles;
+	std::mutex adding;	// also guards frozen
+	int frozen = 0;		// Frozen scopes alive, they can overlap (ie two cameras rendering the same scene)
+
+	// with adding held
+	auto refuseIfFrozen(const char* what) const -> void {
+		if (this->frozen == 0) return;
+		std::cerr << "ERROR: Materials can't be " << what << " while a render is looking them up.\n";
+		std::abort();
+	}
+
+public:
+	// freezes a table for its lifetime
+	class Frozen {
+		MaterialTable& table;
+	public:
+		Frozen(MaterialTable& t) : table(t) {
+			std::lock_guard<std::mutex> lock(this->table.adding);
+			this->table.frozen++;
+		}
+		~Frozen() {
+			std::lock_guard<std::mutex> lock(this->table.adding);
+			this->table.frozen--;
+		}
+		Frozen(const Frozen&) = delete;
+		auto operator=(const Frozen&) -> Frozen& = delete;
+	};
+
+	auto add(shared_ptr<Material> material) -> MaterialHandle {
+		std::lock_guard<std::mutex> lock(this->adding);
+		this->refuseIfFrozen("added");
+		auto [slot, isNew] = this->handles.try_emplace(material.get(), static_cast<MaterialHandle>(this->entries.size()));
+		if (isNew) this->entries.push_back(std::move(material));
+		return slot->second;
+	}
+	auto operator[](MaterialHandle handle) const -> const Material& { return *this->entries[handle]; }
+	auto size() const -> size_t { return this->entries.size(); }
+	// drop every material, any handle still held is dangling from here on
+	auto clear() -> void {
+		std::lock_guard<std::mutex> lock(this->adding);
+		this->refuseIfFrozen("dropped");
+		this->entries.clear();
+		this->handles.clear();
+	}
+};
+
+// the materials of the scene being built or rendered
+inline MaterialTable sceneMaterials;
@@ -0,0 +1,518 @@
+#pragma once
+
+#include "common.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+	Triangles as loaded from a file, ready to hand to TriangleMesh.
+	Vertex attributes live in shared buffers and every triangle corner indexes into them. OBJ indexes
+	positions, normals and texture coordinates separately, so each has its own index buffer. normalIndices
+	and uvIndices are either empty (the file has none, or not for every corner) or as long as indices.
+*/
+struct MeshData {
+	std::vector<Point3> positions;
+	std::vector<Vec3> normals;
+	std::vector<Real> uvs;					// u, v pairs
+	std::vector<uint32_t> indices;			// 3 per triangle, into positions
+	std::vector<uint32_t> normalIndices;	// 3 per triangle, into normals
+	std::vector<uint32_t> uvIndices;		// 3 per triangle, into uv pairs
+
+	auto triangleCount() const -> size_t { return this->indices.size() / 3; }
+};
+
+/*
+	Wavefront OBJ and PLY (ascii, binary little and big endian) readers.
+	Files are read in one go. OBJ is cut into chunks at line breaks and parsed on a thread pool in two
+	passes: the first only counts v, vn and vt lines per chunk, so every chunk knows where its vertices
+	land in the shared buffers (and what relative, negative, indices point at) before the second pass
+	parses them straight into place. Faces, whose triangle count isn't known up front, go into per chunk
+	lists that are joined in file order. Polygons are split into fans of triangles.
+	Binary PLY vertices are fixed size records and are converted in parallel the same way, faces are
+	a single scan. Only positions, normals (nx ny nz) and texture coordinates (u v, s t or texture_u
+	texture_v) are kept, materials and every other element are skipped.
+	Failures print an error and return false.
+*/
+class MeshLoader {
+	static constexpr size_t chunkSize = 1 << 20; // bytes of OBJ text per parallel task
+
+	static auto readFile(const std::string& path, std::string& contents) -> bool {
+		std::ifstream in(path, std::ios::binary | std::ios::ate);
+		if (!in) {
+			std::cerr << "ERROR: Could not open mesh file '" << path << "'.\n";
+			return false;
+		}
+		contents.resize(static_cast<size_t>(in.tellg()));
+		in.seekg(0);
+		if (!in.read(contents.data(), static_cast<std::streamsize>(contents.size()))) {
+			std::cerr << "ERROR: Failed reading mesh file '" << path << "'.\n";
+			return false;
+		}
+		return true;
+	}
+	// OBJ values never run past the end of their line, ascii PLY ones do (acrossLines)
+	static auto skipSpaces(const char*& p, const char* end, bool acrossLines = false) -> void {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || (acrossLines && *p == '\n'))) p++;
+	}
+	static auto parseReal(const char*& p, const char* end, Real& value, bool acrossLines = false) -> bool {
+		skipSpaces(p, end, acrossLines);
+		if (p < end && *p == '+') p++; // from_chars doesn't take a leading plus
+		auto [next, error] = std::from_chars(p, end, value);
+		if (error != std::errc()) return false;
+		p = next;
+		return true;
+	}
+	template <typename T>
+	static auto parseInteger(const char*& p, const char* end, T& value, bool acrossLines = false) -> bool {
+		skipSpaces(p, end, acrossLines);
+		auto [next, error] = std::from_chars(p, end, value);
+		if (error != std::errc()) return false;
+		p = next;
+		return true;
+	}
+
+	/*
+		Chunk boundaries of an OBJ file, every one but the last just past a line break.
+	*/
+	static auto splitLines(const std::string& text) -> std::vector<size_t> {
+		std::vector<size_t> bounds{ 0 };
+		while (bounds.back() + chunkSize < text.size()) {
+			auto cut = text.find('\n', bounds.back() + chunkSize);
+			if (cut == std::string::npos) break;
+			bounds.push_back(cut + 1);
+		}
+		bounds.push_back(text.size());
+		return bounds;
+	}
+	struct ObjChunk {
+		size_t positions = 0, normals = 0, uvs = 0;	// counts in pass 1, then where this chunk's first ones land
+		std::vector<uint32_t> indices, normalIndices, uvIndices;
+		bool allNormals = true, allUvs = true;
+		size_t errorLine = 0;						// 1 based line number within the chunk, 0 => fine
+	};
+	static auto lineKind(const char* p, const char* end) -> int { // 1 v, 2 vn, 3 vt, 4 f, 0 anything else
+		if (end - p < 2) return 0;
+		if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) return 4;
+		if (p[0] != 'v') return 0;
+		if (p[1] == ' ' || p[1] == '\t') return 1;
+		if (end - p < 3 || (p[2] != ' ' && p[2] != '\t')) return 0;
+		if (p[1] == 'n') return 2;
+		if (p[1] == 't') return 3;
+		return 0;
+	}
+	static auto countObjChunk(const char* p, const char* end, ObjChunk& chunk) -> void {
+		while (p < end) {
+			auto lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+			if (!lineEnd) lineEnd = end;
+			switch (lineKind(p, lineEnd)) {
+				case 1: chunk.positions++; break;
+				case 2: chunk.normals++; break;
+				case 3: chunk.uvs++; break;
+			}
+			p = lineEnd + 1;
+		}
+	}
+	// OBJ indices are 1 based, negative ones count back from the last vertex read so far
+	static auto resolveIndex(long long index, size_t seen) -> long long {
+		return index < 0 ? static_cast<long long>(seen) + index : index - 1;
+	}
+	static auto parseObjChunk(const char* p, const char* end, ObjChunk& chunk, MeshData& mesh) -> void {
+		auto position = chunk.positions, normal = chunk.normals, uv = chunk.uvs;
+		std::vector<long long> corners[3]; // position, uv, normal index of every corner of the current face
+		size_t line = 0;
+		while (p < end && chunk.errorLine == 0) {
+			line++;
+			auto lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+			if (!lineEnd) lineEnd = end;
+			auto kind = lineKind(p, lineEnd);
+			auto q = p + (kind == 1 || kind == 4 ? 1 : 2);
+			bool ok = true;
+			if (kind == 1) {
+				Real x, y, z;
+				ok = parseReal(q, lineEnd, x) && parseReal(q, lineEnd, y) && parseReal(q, lineEnd, z);
+				if (ok) mesh.positions[position++] = Point3(x, y, z);
+			}
+			else if (kind == 2) {
+				Real x, y, z;
+				ok = parseReal(q, lineEnd, x) && parseReal(q, lineEnd, y) && parseReal(q, lineEnd, z);
+				if (ok) mesh.normals[normal++] = Vec3(x, y, z);
+			}
+			else if (kind == 3) {
+				Real u, v = 0;
+				ok = parseReal(q, lineEnd, u);
+				parseReal(q, lineEnd, v); // v is optional
+				if (ok) {
+					mesh.uvs[2 * uv] = u;
+					mesh.uvs[2 * uv + 1] = v;
+					uv++;
+				}
+			}
+			else if (kind == 4) {
+				for (auto& c : corners) c.clear();
+				while (ok) { // v, v/vt, v//vn or v/vt/vn per corner
+					skipSpaces(q, lineEnd);
+					if (q >= lineEnd || *q == '#') break;
+					long long value[3] = { 0, 0, 0 };
+					bool present[3] = { false, false, false };
+					ok = parseInteger(q, lineEnd, value[0]);
+					present[0] = ok;
+					for (int slot = 1; slot < 3 && ok && q < lineEnd && *q == '/'; slot++) {
+						q++;
+						if (q < lineEnd && *q != '/' && *q != ' ' && *q != '\t' && *q != '\r') {
+							ok = parseInteger(q, lineEnd, value[slot]);
+							present[slot] = ok;
+						}
+					}
+					if (!ok) break;
+					corners[0].push_back(resolveIndex(value[0], position));
+					corners[1].push_back(present[1] ? resolveIndex(value[1], uv) : -1);
+					corners[2].push_back(present[2] ? resolveIndex(value[2], normal) : -1);
+				}
+				ok = ok && corners[0].size() >= 3;
+				for (size_t k = 1; ok && k + 1 < corners[0].size(); k++) {
+					for (auto corner : { size_t(0), k, k + 1 }) {
+						chunk.indices.push_back(static_cast<uint32_t>(corners[0][corner]));
+						chunk.uvIndices.push_back(static_cast<uint32_t>(corners[1][corner]));
+						chunk.normalIndices.push_back(static_cast<uint32_t>(corners[2][corner]));
+						chunk.allUvs = chunk.allUvs && corners[1][corner] >= 0;
+						chunk.allNormals = chunk.allNormals && corners[2][corner] >= 0;
+					}
+				}
+			}
+			if (!ok) chunk.errorLine = line;
+			p = lineEnd + 1;
+		}
+	}
+
+	struct PlyProperty {
+		std::string name;
+		std::string type;
+		std::string countType;	// non empty for list properties
+	};
+	struct PlyElement {
+		std::string name;
+		size_t count;
+		std::vector<PlyProperty> properties;
+	};
+	static auto plyTypeSize(const std::string& type) -> size_t {
+		if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+		if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+		if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32") return 4;
+		if (type == "double" || type == "float64") return 8;
+		return 0;
+	}
+	template <typename T>
+	static auto readBinary(const char* p, bool swapBytes) -> T {
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, p, sizeof(T));
+		if (swapBytes) std::reverse(bytes, bytes + sizeof(T));
+		T value;
+		std::memcpy(&value, bytes, sizeof(T));
+		return value;
+	}
+	static auto readBinaryValue(const char* p, const std::string& type, bool swapBytes) -> double {
+		if (type == "char" || type == "int8") return readBinary<int8_t>(p, swapBytes);
+		if (type == "uchar" || type == "uint8") return readBinary<uint8_t>(p, swapBytes);
+		if (type == "short" || type == "int16") return readBinary<int16_t>(p, swapBytes);
+		if (type == "ushort" || type == "uint16") return readBinary<uint16_t>(p, swapBytes);
+		if (type == "int" || type == "int32") return readBinary<int32_t>(p, swapBytes);
+		if (type == "uint" || type == "uint32") return readBinary<uint32_t>(p, swapBytes);
+		if (type == "float" || type == "float32") return readBinary<float>(p, swapBytes);
+		return readBinary<double>(p, swapBytes);
+	}
+	// where each kept vertex attribute sits in a vertex record (binary: byte offset, ascii: value index), -1 if absent
+	struct PlyVertexLayout {
+		int position[3] = { -1, -1, -1 };
+		int normal[3] = { -1, -1, -1 };
+		int uv[2] = { -1, -1 };
+		std::string type[8];	// of the attributes above, in that order
+	};
+	static auto plyVertexLayout(const PlyElement& vertices, bool binary, PlyVertexLayout& layout, size_t& recordSize) -> bool {
+		int at = 0;
+		for (const auto& property : vertices.properties) {
+			if (!property.countType.empty()) return false; // lists in vertices would make records variable size
+			const auto& n = property.name;
+			int slot = -1;
+			if (n == "x") slot = 0; else if (n == "y") slot = 1; else if (n == "z") slot = 2;
+			else if (n == "nx") slot = 3; else if (n == "ny") slot = 4; else if (n == "nz") slot = 5;
+			else if (n == "u" || n == "s" || n == "texture_u") slot = 6;
+			else if (n == "v" || n == "t" || n == "texture_v") slot = 7;
+			if (slot >= 0) {
+				int* target = slot < 3 ? &layout.position[slot] : slot < 6 ? &layout.normal[slot - 3] : &layout.uv[slot - 6];
+				*target = at;
+				layout.type[slot] = property.type;
+			}
+			at += binary ? static_cast<int>(plyTypeSize(property.type)) : 1;
+		}
+		recordSize = static_cast<size_t>(at);
+		return layout.position[0] >= 0 && layout.position[1] >= 0 && layout.position[2] >= 0;
+	}
+
+public:
+	/*
+		Pick the reader by extension (.obj or .ply, any case).
+	*/
+	static auto load(const std::string& path, MeshData& mesh) -> bool {
+		auto dot = path.find_last_of('.');
+		auto extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		if (extension == "obj") return loadObj(path, mesh);
+		if (extension == "ply") return loadPly(path, mesh);
+		std::cerr << "ERROR: Unknown mesh format '" << path << "', expected .obj or .ply.\n";
+		return false;
+	}
+
+	static auto loadObj(const std::string& path, MeshData& mesh) -> bool {
+		std::string text;
+		if (!readFile(path, text)) return false;
+		auto bounds = splitLines(text);
+		auto chunkCount = bounds.size() - 1;
+		std::vector<ObjChunk> chunks(chunkCount);
+		auto threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), chunkCount);
+		std::unique_ptr<ThreadPool> pool;
+		if (threads > 1) pool = std::make_unique<ThreadPool>(static_cast<unsigned int>(threads));
+		auto forEachChunk = [&](const std::function<void(size_t)>& body) {
+			auto run = [&](size_t begin, size_t end) {
+				for (size_t c = begin; c < end; c++) body(c);
+			};
+			if (pool) parallelFor(*pool, chunkCount, 1, run);
+			else run(0, chunkCount);
+		};
+
+		forEachChunk([&](size_t c) { countObjChunk(text.data() + bounds[c], text.data() + bounds[c + 1], chunks[c]); });
+		size_t positions = 0, normals = 0, uvs = 0;
+		for (auto& chunk : chunks) { // counts become offsets
+			positions += std::exchange(chunk.positions, positions);
+			normals += std::exchange(chunk.normals, normals);
+			uvs += std::exchange(chunk.uvs, uvs);
+		}
+		mesh = MeshData();
+		mesh.positions.resize(positions);
+		mesh.normals.resize(normals);
+		mesh.uvs.resize(2 * uvs);
+		forEachChunk([&](size_t c) { parseObjChunk(text.data() + bounds[c], text.data() + bounds[c + 1], chunks[c], mesh); });
+
+		bool allNormals = normals > 0, allUvs = uvs > 0;
+		size_t indexCount = 0;
+		for (size_t c = 0; c < chunkCount; c++) {
+			if (chunks[c].errorLine != 0) {
+				auto line = std::count(text.begin(), text.begin() + static_cast<std::ptrdiff_t>(bounds[c]), '\n') + chunks[c].errorLine;
+				std::cerr << "ERROR: Could not parse line " << line << " of '" << path << "'.\n";
+				return false;
+			}
+			allNormals = allNormals && chunks[c].allNormals;
+			allUvs = allUvs && chunks[c].allUvs;
+			indexCount += chunks[c].indices.size();
+		}
+		mesh.indices.reserve(indexCount);
+		if (allNormals) mesh.normalIndices.reserve(indexCount);
+		if (allUvs) mesh.uvIndices.reserve(indexCount);
+		for (const auto& chunk : chunks) {
+			mesh.indices.insert(mesh.indices.end(), chunk.indices.begin(), chunk.indices.end());
+			if (allNormals) mesh.normalIndices.insert(mesh.normalIndices.end(), chunk.normalIndices.begin(), chunk.normalIndices.end());
+			if (allUvs) mesh.uvIndices.insert(mesh.uvIndices.end(), chunk.uvIndices.begin(), chunk.uvIndices.end());
+		}
+		if (!allNormals) mesh.normals.clear();
+		if (!allUvs) mesh.uvs.clear();
+		return MeshLoader::validate(path, mesh);
+	}
+
+	static auto loadPly(const std::string& path, MeshData& mesh) -> bool {
+		std::string text;
+		if (!readFile(path, text)) return false;
+		auto fail = [&](const char* what) {
+			std::cerr << "ERROR: '" << path << "' is not a readable PLY file (" << what << ").\n";
+			return false;
+		};
+		// header
+		auto headerEnd = text.find("end_header");
+		if (text.compare(0, 3, "ply") != 0 || headerEnd == std::string::npos) return fail("no header");
+		auto bodyStart = text.find('\n', headerEnd);
+		if (bodyStart == std::string::npos) return fail("no body");
+		bodyStart++;
+		std::string format;
+		std::vector<PlyElement> elements;
+		{
+			std::istringstream header(text.substr(0, headerEnd));
+			std::string line;
+			while (std::getline(header, line)) {
+				std::istringstream words(line);
+				std::string keyword;
+				words >> keyword;
+				if (keyword == "format") words >> format;
+				else if (keyword == "element") {
+					PlyElement element;
+					words >> element.name >> element.count;
+					elements.push_back(element);
+				}
+				else if (keyword == "property" && !elements.empty()) {
+					PlyProperty property;
+					words >> property.type;
+					if (property.type == "list") words >> property.countType >> property.type;
+					words >> property.name;
+					elements.back().properties.push_back(property);
+				}
+			}
+		}
+		bool binary = format != "ascii";
+		bool swapBytes = (format == "binary_big_endian") == (std::endian::native == std::endian::little);
+		if (binary && format != "binary_little_endian" && format != "binary_big_endian") return fail("unknown format");
+		for (const auto& element : elements)
+			for (const auto& property : element.properties)
+				if (plyTypeSize(property.type) == 0 || (!property.countType.empty() && plyTypeSize(property.countType) == 0))
+					return fail("unknown property type");
+
+		mesh = MeshData();
+		const char* p = text.data() + bodyStart;
+		const char* end = text.data() + text.size();
+		bool haveVertices = false;
+		for (const auto& element : elements) {
+			if (element.name == "vertex") {
+				PlyVertexLayout layout;
+				size_t recordSize;
+				if (!plyVertexLayout(element, binary, layout, recordSize)) return fail("vertices without x y z");
+				bool normals = layout.normal[0] >= 0 && layout.normal[1] >= 0 && layout.normal[2] >= 0;
+				bool uvs = layout.uv[0] >= 0 && layout.uv[1] >= 0;
+				// every value takes at least a byte, so a count the rest of the file can't hold is rejected before allocating for it
+				if (element.count > static_cast<size_t>(end - p) / recordSize) return fail("truncated");
+				mesh.positions.resize(element.count);
+				if (normals) mesh.normals.resize(element.count);
+				if (uvs) mesh.uvs.resize(2 * element.count);
+				if (binary) {
+					auto convert = [&](size_t begin, size_t last) {
+						for (size_t i = begin; i < last; i++) {
+							auto record = p + i * recordSize;
+							auto value = [&](int slot, int offset) { return static_cast<Real>(readBinaryValue(record + offset, layout.type[slot], swapBytes)); };
+							mesh.positions[i] = Point3(value(0, layout.position[0]), value(1, layout.position[1]), value(2, layout.position[2]));
+							if (normals) mesh.normals[i] = Vec3(value(3, layout.normal[0]), value(4, layout.normal[1]), value(5, layout.normal[2]));
+							if (uvs) {
+								mesh.uvs[2 * i] = value(6, layout.uv[0]);
+								mesh.uvs[2 * i + 1] = value(7, layout.uv[1]);
+							}
+						}
+					};
+					if (element.count >= 2 * chunkSize / recordSize) {
+						ThreadPool pool;
+						parallelFor(pool, element.count, chunkSize / recordSize, convert);
+					}
+					else convert(0, element.count);
+					p += element.count * recordSize;
+				}
+				else {
+					std::vector<Real> values(recordSize);
+					for (size_t i = 0; i < element.count; i++) {
+						for (auto& value : values)
+							if (!parseReal(p, end, value, true)) return fail("bad vertex");
+						mesh.positions[i] = Point3(values[layout.position[0]], values[layout.position[1]], values[layout.position[2]]);
+						if (normals) mesh.normals[i] = Vec3(values[layout.normal[0]], values[layout.normal[1]], values[layout.normal[2]]);
+						if (uvs) {
+							mesh.uvs[2 * i] = values[layout.uv[0]];
+							mesh.uvs[2 * i + 1] = values[layout.uv[1]];
+						}
+					}
+				}
+				haveVertices = true;
+				continue;
+			}
+			// faces are read, anything else only stepped over
+			bool faces = element.name == "face";
+			std::vector<uint32_t> polygon;
+			auto vertexIndex = [&](double value) -> bool { // false for what no vertex has, casting it would be undefined
+				if (!(value >= 0 && value <= std::numeric_limits<uint32_t>::max())) return false;
+				polygon.push_back(static_cast<uint32_t>(value));
+				return true;
+			};
+			for (size_t i = 0; i < element.count; i++) {
+				for (const auto& property : element.properties) {
+					bool keep = faces && (property.name == "vertex_indices" || property.name == "vertex_index");
+					if (property.countType.empty()) { // single value
+						if (binary) {
+							if (static_cast<size_t>(end - p) < plyTypeSize(property.type)) return fail("truncated");
+							p += plyTypeSize(property.type);
+						}
+						else {
+							Real skipped;
+							if (!parseReal(p, end, skipped, true)) return fail("bad value");
+						}
+						continue;
+					}
+					size_t count;
+					if (binary) {
+						if (static_cast<size_t>(end - p) < plyTypeSize(property.countType)) return fail("truncated");
+						auto value = readBinaryValue(p, property.countType, swapBytes);
+						p += plyTypeSize(property.countType);
+						if (!(value >= 0 && value <= static_cast<double>(static_cast<size_t>(end - p) / plyTypeSize(property.type)))) return fail("truncated");
+						count = static_cast<size_t>(value);
+					}
+					else if (!parseInteger(p, end, count, true)) return fail("bad list");
+					polygon.clear();
+					for (size_t k = 0; k < count; k++) {
+						if (binary) {
+							if (keep && !vertexIndex(readBinaryValue(p, property.type, swapBytes))) return fail("bad vertex index");
+							p += plyTypeSize(property.type);
+						}
+						else {
+							Real value;
+							if (!parseReal(p, end, value, true)) return fail("bad list");
+							if (keep && !vertexIndex(value)) return fail("bad vertex index");
+						}
+					}
+					for (size_t k = 1; keep && k + 1 < polygon.size(); k++) {
+						mesh.indices.push_back(polygon[0]);
+						mesh.indices.push_back(polygon[k]);
+						mesh.indices.push_back(polygon[k + 1]);
+					}
+				}
+			}
+		}
+		if (!haveVertices) return fail("no vertex element");
+		// PLY attributes are per vertex, so the normal and uv corners are the position corners
+		if (!mesh.normals.empty()) mesh.normalIndices = mesh.indices;
+		if (!mesh.uvs.empty()) mesh.uvIndices = mesh.indices;
+		return MeshLoader::validate(path, mesh);
+	}
+
+	// every index in range, so TriangleMesh never has to check
+	static auto validate(const std::string& path, const MeshData& mesh) -> bool {
+		if (!MeshLoader::consistent(
+			mesh.indices, mesh.normalIndices, mesh.uvIndices, mesh.positions.size(), mesh.normals.size(), mesh.uvs.size() / 2
+		)) {
+			std::cerr << "ERROR: '" << path << "' has faces using vertices it doesn't have.\n";
+			return false;
+		}
+		return true;
+	}
+	/*
+		Whether index buffers are what TriangleMesh can use as they are: whole triangles, normal and uv
+		indices either absent or one per corner, and every index below the size of the buffer it points into.
+		Also how a mapped mesh cache is checked, its buffers come straight from the file.
+	*/
+	static auto consistent(
+		std::span<const uint32_t> indices, std::span<const uint32_t> normalIndices, std::span<const uint32_t> uvIndices,
+		size_t positions, size_t normals, size_t uvPairs
+	) -> bool {
+		auto inRange = [](std::span<const uint32_t> values, size_t size) {
+			return std::all_of(values.begin(), values.end(), [size](uint32_t i) { return i < size; });
+		};
+		auto perCorner = [&](std::span<const uint32_t> values) { return values.empty() || values.size() == indices.size(); };
+		return indices.size() % 3 == 0 && perCorner(normalIndices) && perCorner(uvIndices)
+			&& inRange(indices, positions) && inRange(normalIndices, normals) && inRange(uvIndices, uvPairs);
+	}
+};
@@ -1,30 +1,84 @@
 #pragma once
 
 #include "Vec3.hpp"
+#include "Sampler.hpp"
+
+#include <cstdint>
+#include <cstring>
 
 /*
 	Ray
 		- origin
 		- direction
 		- f(t) = origin + direction * t
-		- time component used in monte carlo simulations 
+		- time component used in monte carlo simulations
+		- sampler of the camera sample this ray belongs to, for hittables that make random
+		  decisions during intersection (participating media). may be null
 */
-class Ray {
-	Point3 orig;
-	Vec3 dir;
-	double tm;
-	
+template <typename T>
+class RayT {
+	Vec3T<T> orig;
+	Vec3T<T> dir;
+	T tm;
+	Sampler* smp;
+
 public:
-	Ray() {}
-	Ray(const Point3& origin, const Vec3& direction) : orig{ origin }, dir{ direction }, tm{ 0 } {}
-	Ray(const Point3& origin, const Vec3& direction, double time)
-		: orig{ origin }, dir{ direction }, tm{ time } {}
-	
-	auto origin() const -> Point3 { return orig; }
-	auto direction() const -> Vec3 { return dir; }
-	auto time() const -> double { return tm; }
-
-	auto at(double t) const -> Point3 {
+	RayT() : tm{ 0 }, smp{ nullptr } {}
+	RayT(const Vec3T<T>& origin, const Vec3T<T>& direction) : orig{ origin }, dir{ direction }, tm{ 0 }, smp{ nullptr } {}
+	RayT(const Vec3T<T>& origin, const Vec3T<T>& direction, T time, Sampler* sampler = nullptr)
+		: orig{ origin }, dir{ direction }, tm{ time }, smp{ sampler } {}
+
+	auto origin() const -> Vec3T<T> { return orig; }
+	auto direction() const -> Vec3T<T> { return dir; }
+	auto time() const -> T { return tm; }
+	auto sampler() const -> Sampler* { return smp; }
+
+	auto at(T t) const -> Vec3T<T> {
 		return orig + t * dir;
 	}
 };
+
+using Ray = RayT<Real>;
+
+/*
+	How far a new ray's origin is pushed off the surface it leaves.
+	Far from the world origin the offset is a fixed number of units in the last place of each coordinate,
+	so it grows with the rounding error of the hit point instead of being one absolute distance
+	(the old 0.001 t-min was far too big up close and too small on a float scene kilometres out).
+	Near the origin, where ulps get tiny, a small absolute offset takes over.
+	Wachter & Binder, "A Fast and Robust Method for Avoiding Self-Intersection" (Ray Tracing Gems, 2019).
+	The double constants keep the same shape with a margin sized for double's rounding.
+*/
+template <typename T> struct RayOffset;
+template <> struct RayOffset<float> {
+	using Bits = int32_t;
+	static constexpr float origin = 1.0f / 32.0f;
+	static constexpr float floatScale = 1.0f / 65536.0f;
+	static constexpr float intScale = 256.0f;
+};
+template <> struct RayOffset<double> {
+	using Bits = int64_t;
+	static constexpr double origin = 1.0 / 32.0;
+	static constexpr double floatScale = 1.0 / 65536.0;
+	static constexpr double intScale = 256.0 * 1048576.0;
+};
+
+// p moved off its surface to the side n points to (n is the geometric normal, flipped to the side the new ray leaves on)
+template <typename T>
+inline auto offsetRayOrigin(const Vec3T<T>& p, const Vec3T<T>& n) -> Vec3T<T> {
+	using Offset = RayOffset<T>;
+	using Bits = typename Offset::Bits;
+	Vec3T<T> result;
+	for (int a = 0; a < 3; a++) {
+		if (std::fabs(p[a]) < Offset::origin) {
+			result[a] = p[a] + Offset::floatScale * n[a];
+			continue;
+		}
+		auto ulps = static_cast<Bits>(Offset::intScale * n[a]);
+		Bits bits;
+		std::memcpy(&bits, &p.e[a], sizeof(T));
+		bits += p[a] < 0 ? -ulps : ulps;
+		std::memcpy(&result.e[a], &bits, sizeof(T));
+	}
+	return result;
+}
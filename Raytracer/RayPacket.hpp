@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.hpp"
+#include "SimdLanes.hpp"
+
+/*
+	A handful of rays that start close together and point the same way (camera rays of one pixel),
+	traced through the scene as a group.
+	Bounding volumes test every lane at once and the group walks the BVH a single time, dropping
+	lanes from the active mask as they miss. Anything without a packet routine of its own falls
+	back to tracing the remaining lanes one by one, with the lane's own Ray.
+	Origin and inverse direction are kept transposed (x of every lane, then y, then z) so each axis
+	of a slab test is one load.
+*/
+struct RayPacket {
+	static constexpr int width = SimdLanes<Real>::width;
+
+	const Ray* rays;	// width rays, lanes past count are never active
+	int count;
+	Real tMin;
+	alignas(32) Real origin[3][width];
+	alignas(32) Real inverseDirection[3][width];
+
+	RayPacket(const Ray* _rays, int _count, Real _tMin) : rays(_rays), count(_count), tMin(_tMin) {
+		for (int lane = 0; lane < width; lane++) {
+			const auto& r = this->rays[lane < this->count ? lane : 0]; // idle lanes repeat lane 0
+			for (int a = 0; a < 3; a++) {
+				this->origin[a][lane] = r.origin()[a];
+				this->inverseDirection[a][lane] = 1 / r.direction()[a];
+			}
+		}
+	}
+
+	auto activeMask() const -> uint32_t { return (1u << this->count) - 1; }
+	/*
+		Slab test of every lane in mask against the box [lower, upper], over (tMin, tMax[lane]).
+		Returns the lanes that enter the box. Same arithmetic as AxisAlignedBoundingBox::hit, so a lane
+		gets exactly the answer its ray would get on its own. Running on after an axis has already
+		emptied a lane's interval is harmless, it can only shrink further.
+		With tEntry given (width values, aligned to 32 bytes), also stores where each lane enters the box.
+	*/
+	auto slabTest(const Real lower[3], const Real upper[3], uint32_t mask, const Real* tMax, Real* tEntry = nullptr) const -> uint32_t {
+		SimdLanes<Real> tNear(this->tMin);
+		auto tFar = SimdLanes<Real>::load(tMax);
+		for (int a = 0; a < 3; a++) {
+			auto invD = SimdLanes<Real>::load(this->inverseDirection[a]);
+			auto orig = SimdLanes<Real>::load(this->origin[a]);
+			auto t0 = (SimdLanes<Real>(lower[a]) - orig) * invD;
+			auto t1 = (SimdLanes<Real>(upper[a]) - orig) * invD;
+			auto negative = lessThan(invD, SimdLanes<Real>(0));
+			tNear = max(select(negative, t0, t1), tNear);
+			tFar = min(select(negative, t1, t0), tFar);
+		}
+		if (tEntry) tNear.store(tEntry);
+		return mask & greaterThan(tFar, tNear).bits();
+	}
+};
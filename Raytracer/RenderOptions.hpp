@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/*
+	Command line overrides for the scene functions in main.cpp.
+	Scenes set up their own camera, then apply these on top just before rendering, so one scene can be
+	split across several processes (each rendering some tiles or some samples into a partial file)
+	and merged afterwards with RaytracerMerge.
+		Raytracer [scene] [options]
+			--output <file>         image to write (.ppm, .pfm, .exr)
+			--threads <n>           render threads
+			--seed <n>              random stream seed
+			--tiles <begin>:<end>   render only this run of the Morton ordered tiles
+			--samples <begin>:<end> take only these samples of every pixel
+			--part <k>/<n>          take the k-th of n equal slices of every pixel's samples
+			--partial <file>        write the raw accumulation (for RaytracerMerge) instead of an image
+			--checkpoint <file>     checkpoint progress to file
+			--resume                continue from the checkpoint (same scene, seed and samples per pixel, --samples may end later)
+			--adaptive              stop sampling converged pixels
+			--wavefront             trace material sorted batches of paths instead of one path at a time
+			--no-light-sampling     only find lights by bouncing into them, no shadow rays aimed at them
+			--uniform-lights        pick the light to aim at uniformly instead of with the light tree
+			--bvh-stats             print the size, SAH cost and build time of every BVH the scene builds
+			--mesh <file>           .obj or .ply model for the mesh scene (10)
+			--mesh-cache <file>     keep the mesh scene's triangles and BVH in file, mapped back while the model is unchanged
+*/
+struct RenderOptions {
+	int scene = 7;
+	std::string outputPath;
+	std::string partialPath;
+	std::string checkpointPath;
+	std::string meshPath;		// read by the scene itself, not the camera
+	std::string meshCachePath;	// as meshPath
+	unsigned int threads = 0;	// 0 => camera default
+	int seed = -1;				// -1 => camera default
+	int tileBegin = 0, tileEnd = -1;
+	int sampleBegin = 0, sampleEnd = -1;
+	int partIndex = 0, partCount = 0;	// partCount 0 => no slicing
+	bool resume = false;
+	bool adaptive = false;
+	bool wavefront = false;
+	bool noLightSampling = false;
+	bool uniformLights = false;
+	bool bvhStats = false;		// read by the scene itself, through bvhOptions
+
+	auto applyTo(Camera& cam) const -> void {
+		if (!this->outputPath.empty()) cam.outputPath = this->outputPath;
+		if (!this->partialPath.empty()) cam.partialPath = this->partialPath;
+		if (!this->checkpointPath.empty()) cam.checkpointPath = this->checkpointPath;
+		if (this->threads > 0) cam.threadCount = this->threads;
+		if (this->seed >= 0) cam.seed = static_cast<uint32_t>(this->seed);
+		cam.resumeFromCheckpoint = this->resume;
+		cam.adaptiveSampling = cam.adaptiveSampling || this->adaptive;
+		cam.wavefront = cam.wavefront || this->wavefront;
+		if (this->noLightSampling) cam.sampleLights = false;
+		if (this->uniformLights) cam.lightTree = false;
+		cam.tileRangeBegin = this->tileBegin;
+		cam.tileRangeEnd = this->tileEnd;
+		cam.sampleRangeBegin = this->sampleBegin;
+		cam.sampleRangeEnd = this->sampleEnd;
+		if (this->partCount > 0) { // same slicing of the (squared) sample count the camera will use
+			auto sqrtSamples = std::max(static_cast<int>(sqrt(cam.samplePerPixel)), 1);
+			auto samples = sqrtSamples * sqrtSamples;
+			cam.sampleRangeBegin = samples * this->partIndex / this->partCount;
+			cam.sampleRangeEnd = samples * (this->partIndex + 1) / this->partCount;
+		}
+	}
+
+	// base with the options' say on BVH builds applied, for scenes to build their trees with
+	auto bvhOptions(BoundingVolumeHierarchyOptions base = {}) const -> BoundingVolumeHierarchyOptions {
+		base.printStats = this->bvhStats;
+		return base;
+	}
+
+	static auto parse(int argc, char* argv[], RenderOptions& options) -> bool {
+		for (int a = 1; a < argc; a++) {
+			std::string arg = argv[a];
+			auto next = [&]() -> std::string {
+				return a + 1 < argc ? std::string(argv[++a]) : std::string();
+			};
+			auto range = [](const std::string& value, char separator, int& first, int& second) -> bool {
+				auto split = value.find(separator);
+				if (split == std::string::npos) return false;
+				first = std::atoi(value.substr(0, split).c_str());
+				second = std::atoi(value.substr(split + 1).c_str());
+				return true;
+			};
+			bool ok = true;
+			if (arg == "--output") options.outputPath = next();
+			else if (arg == "--partial") options.partialPath = next();
+			else if (arg == "--checkpoint") options.checkpointPath = next();
+			else if (arg == "--mesh") options.meshPath = next();
+			else if (arg == "--mesh-cache") options.meshCachePath = next();
+			else if (arg == "--threads") options.threads = static_cast<unsigned int>(std::atoi(next().c_str()));
+			else if (arg == "--seed") options.seed = std::atoi(next().c_str());
+			else if (arg == "--tiles") ok = range(next(), ':', options.tileBegin, options.tileEnd);
+			else if (arg == "--samples") ok = range(next(), ':', options.sampleBegin, options.sampleEnd);
+			else if (arg == "--part") ok = range(next(), '/', options.partIndex, options.partCount)
+				&& options.partCount > 0 && options.partIndex >= 0 && options.partIndex < options.partCount;
+			else if (arg == "--resume") options.resume = true;
+			else if (arg == "--adaptive") options.adaptive = true;
+			else if (arg == "--wavefront") options.wavefront = true;
+			else if (arg == "--no-light-sampling") options.noLightSampling = true;
+			else if (arg == "--uniform-lights") options.uniformLights = true;
+			else if (arg == "--bvh-stats") options.bvhStats = true;
+			else if (!arg.empty() && arg[0] != '-') options.scene = std::atoi(arg.c_str());
+			else ok = false;
+			if (!ok) {
+				std::cerr << "ERROR: Bad argument '" << arg << "'.\n";
+				return false;
+			}
+		}
+		return true;
+	}
+};
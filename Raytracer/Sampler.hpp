@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+	Counter based random number generator.
+	Instead of advancing one shared generator, every random number is a hash of where it is used:
+		(pixel, sample, bounce, dimension)
+	so the value a path sees never depends on which thread traced it or on what was traced before it.
+	Renders are bit-identical for any thread count or tile order, and there is no shared state
+	for threads to fight over.
+	Each Sampler is a small value owned by a single camera sample. Calls to next() walk the dimension
+	counter, nextBounce() moves on to a fresh set of dimensions for the next path vertex.
+
+	Hash is pcg4d from Jarzynski & Olano, "Hash Functions for GPU Rendering" (JCGT 2020).
+*/
+class Sampler {
+	uint32_t pixel;
+	uint32_t sampleIndex;
+	uint32_t bounce;
+	uint32_t dimension;
+
+public:
+	Sampler() : Sampler(0, 0) {}
+	Sampler(uint32_t _pixel, uint32_t _sampleIndex, uint32_t seed = 0) :
+		pixel(_pixel + seed * 0x9E3779B9u),	// golden ratio step keeps seeds from sliding onto neighbouring pixels
+		sampleIndex(_sampleIndex),
+		bounce(0),
+		dimension(0)
+	{}
+
+	auto next() -> double { // returns a random real in [0,1)
+		uint32_t v[4] = { this->pixel, this->sampleIndex, this->bounce, this->dimension++ };
+		Sampler::pcg4d(v);
+		// 53 random mantissa bits from two of the hashed lanes
+		auto bits = ((static_cast<uint64_t>(v[0]) << 32) | v[1]) >> 11;
+		return static_cast<double>(bits) * (1.0 / 9007199254740992.0);
+	}
+	auto next(double min, double max) -> double { // returns a random real in [min, max)
+		return min + (max - min) * this->next();
+	}
+	auto nextBounce() -> void {
+		this->bounce++;
+		this->dimension = 0;
+	}
+	auto currentBounce() const -> uint32_t { return this->bounce; }
+
+private:
+	static auto pcg4d(uint32_t v[4]) -> void {
+		for (int i = 0; i < 4; i++)
+			v[i] = v[i] * 1664525u + 1013904223u;
+		v[0] += v[1] * v[3];
+		v[1] += v[2] * v[0];
+		v[2] += v[0] * v[1];
+		v[3] += v[1] * v[2];
+		for (int i = 0; i < 4; i++)
+			v[i] ^= v[i] >> 16;
+		v[0] += v[1] * v[3];
+		v[1] += v[2] * v[0];
+		v[2] += v[0] * v[1];
+		v[3] += v[1] * v[2];
+	}
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/*
+	One 256 bit register worth of scalars processed side by side, one per lane of a ray packet:
+	4 doubles or 8 floats.
+	Compiled to AVX when the target has it (-mavx2, /arch:AVX2), otherwise plain per lane loops
+	the compiler is free to vectorize with whatever it has.
+	min and max follow the x86 rule of returning the second operand when either is NaN,
+	so a NaN candidate never replaces the running value (same as the scalar "if (t0 > min) min = t0").
+	Comparisons return all bits set (negative) in lanes where they hold.
+*/
+template <typename T>
+struct SimdLanes {
+	static constexpr int width = 32 / sizeof(T);
+
+	alignas(32) T v[width];
+
+	SimdLanes() : v{} {}
+	SimdLanes(T x) {
+		for (int i = 0; i < width; i++) this->v[i] = x;
+	}
+
+	static auto load(const T* p) -> SimdLanes {
+		SimdLanes r;
+		for (int i = 0; i < width; i++) r.v[i] = p[i];
+		return r;
+	}
+	static auto loadUnaligned(const T* p) -> SimdLanes { return load(p); }
+	auto store(T* p) const -> void {
+		for (int i = 0; i < width; i++) p[i] = this->v[i];
+	}
+	static auto loadFloats(const float* p) -> SimdLanes { // width floats, widened to T
+		SimdLanes r;
+		for (int i = 0; i < width; i++) r.v[i] = p[i];
+		return r;
+	}
+
+	template <typename F>
+	static auto each(F f) -> SimdLanes {
+		SimdLanes r;
+		for (int i = 0; i < width; i++) r.v[i] = f(i);
+		return r;
+	}
+	friend auto operator+(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] + b.v[i]; }); }
+	friend auto operator-(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] - b.v[i]; }); }
+	friend auto operator*(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] * b.v[i]; }); }
+	friend auto operator/(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] / b.v[i]; }); }
+	friend auto min(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] < b.v[i] ? a.v[i] : b.v[i]; }); }
+	friend auto max(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] > b.v[i] ? a.v[i] : b.v[i]; }); }
+	friend auto sqrt(SimdLanes a) -> SimdLanes { return each([&](int i) { return std::sqrt(a.v[i]); }); }
+	// lanes of b where mask is set, a elsewhere
+	friend auto select(SimdLanes mask, SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return std::signbit(mask.v[i]) ? b.v[i] : a.v[i]; }); }
+	friend auto lessThan(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] < b.v[i] ? T(-1) : T(0); }); }
+	friend auto greaterThan(SimdLanes a, SimdLanes b) -> SimdLanes { return each([&](int i) { return a.v[i] > b.v[i] ? T(-1) : T(0); }); }
+	auto bits() const -> uint32_t { // one bit per lane, set where the lane is negative
+		uint32_t r = 0;
+		for (int i = 0; i < width; i++) r |= (std::signbit(this->v[i]) ? 1u : 0u) << i;
+		return r;
+	}
+};
+
+#if defined(__AVX__)
+template <>
+struct SimdLanes<double> {
+	static constexpr int width = 4;
+
+	__m256d v;
+
+	SimdLanes() : v(_mm256_setzero_pd()) {}
+	SimdLanes(double x) : v(_mm256_set1_pd(x)) {}
+	SimdLanes(__m256d x) : v(x) {}
+
+	static auto load(const double* p) -> SimdLanes { return _mm256_load_pd(p); } // p aligned to 32 bytes
+	static auto loadUnaligned(const double* p) -> SimdLanes { return _mm256_loadu_pd(p); }
+	static auto loadFloats(const float* p) -> SimdLanes { return _mm256_cvtps_pd(_mm_load_ps(p)); } // p aligned to 16 bytes
+	auto store(double* p) const -> void { _mm256_store_pd(p, this->v); }
+
+	friend auto operator+(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_add_pd(a.v, b.v); }
+	friend auto operator-(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_sub_pd(a.v, b.v); }
+	friend auto operator*(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_mul_pd(a.v, b.v); }
+	friend auto operator/(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_div_pd(a.v, b.v); }
+	friend auto min(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_min_pd(a.v, b.v); }
+	friend auto max(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_max_pd(a.v, b.v); }
+	friend auto sqrt(SimdLanes a) -> SimdLanes { return _mm256_sqrt_pd(a.v); }
+	friend auto select(SimdLanes mask, SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_blendv_pd(a.v, b.v, mask.v); }
+	friend auto lessThan(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+	friend auto greaterThan(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+	auto bits() const -> uint32_t { return static_cast<uint32_t>(_mm256_movemask_pd(this->v)); }
+};
+
+template <>
+struct SimdLanes<float> {
+	static constexpr int width = 8;
+
+	__m256 v;
+
+	SimdLanes() : v(_mm256_setzero_ps()) {}
+	SimdLanes(float x) : v(_mm256_set1_ps(x)) {}
+	SimdLanes(__m256 x) : v(x) {}
+
+	static auto load(const float* p) -> SimdLanes { return _mm256_load_ps(p); } // p aligned to 32 bytes
+	static auto loadUnaligned(const float* p) -> SimdLanes { return _mm256_loadu_ps(p); }
+	static auto loadFloats(const float* p) -> SimdLanes { return load(p); }
+	auto store(float* p) const -> void { _mm256_store_ps(p, this->v); }
+
+	friend auto operator+(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_add_ps(a.v, b.v); }
+	friend auto operator-(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_sub_ps(a.v, b.v); }
+	friend auto operator*(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_mul_ps(a.v, b.v); }
+	friend auto operator/(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_div_ps(a.v, b.v); }
+	friend auto min(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_min_ps(a.v, b.v); }
+	friend auto max(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_max_ps(a.v, b.v); }
+	friend auto sqrt(SimdLanes a) -> SimdLanes { return _mm256_sqrt_ps(a.v); }
+	friend auto select(SimdLanes mask, SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_blendv_ps(a.v, b.v, mask.v); }
+	friend auto lessThan(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	friend auto greaterThan(SimdLanes a, SimdLanes b) -> SimdLanes { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+	auto bits() const -> uint32_t { return static_cast<uint32_t>(_mm256_movemask_ps(this->v)); }
+};
+#endif
@@ -1,29 +1,30 @@
 #pragma once
 
 #include "Hittable.hpp"
+#include "LightList.hpp"
 #include "Vec3.hpp"
 
 struct Sphere : public Hittable {
 	Point3 center1;
-	double radius;
-	shared_ptr<Material> material;
+	Real radius;
+	MaterialHandle material;
 	bool isMoving;
 	Vec3 centerVec;
 	AxisAlignedBoundingBox bbox;
 
 	// Stationary Sphere
-	Sphere(Point3 _center, double _radius, shared_ptr<Material> _material)
+	Sphere(Point3 _center, Real _radius, shared_ptr<Material> _material)
 		: center1{_center},
 		radius{ _radius },
-		material{ _material },
+		material{ sceneMaterials.add(_material) },
 		isMoving{ false }
 	{
 		auto rVec = Vec3(radius, radius, radius);
 		bbox = AxisAlignedBoundingBox(this->center1 - rVec, this->center1 + rVec);
 	}
 	// Moving Sphere
-	Sphere(Point3 _center1, Point3 _center2, double _radius, shared_ptr<Material> _material) :
-		center1{ _center1 }, radius{ _radius }, material{ _material }, isMoving{ true }
+	Sphere(Point3 _center1, Point3 _center2, Real _radius, shared_ptr<Material> _material) :
+		center1{ _center1 }, radius{ _radius }, material{ sceneMaterials.add(_material) }, isMoving{ true }
 	{
 		// need bounds of entire range of motion
 		auto rVec = Vec3(radius, radius, radius);
@@ -37,14 +38,17 @@ struct Sphere : public Hittable {
 	auto boundingBox() const -> AxisAlignedBoundingBox override {
 		return this->bbox;
 	}
-	auto center(double time) const -> Point3 {
+	auto center(Real time) const -> Point3 {
 		// linear interpolate from center1 to center 2 by time (t=0 => center1, t=1 => center2
 		return center1 + time * centerVec;
 	}
 	
-	virtual auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override;
+	virtual auto intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override;
+	virtual auto finalize(const Ray& r, HitRecord& rec) const -> void override;
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		lights.addSphere(this, 0, path, this->center1, this->isMoving ? this->centerVec : Vec3(0, 0, 0), this->radius, this->material);
+	}
 
-private:
 	/*
 		p: a point on the sphere of raidus one, centered at origin
 		u: returned value [0,1] of angle around the y axis from x=-1
@@ -61,7 +65,7 @@ private:
 		phi = atan2(z, -x) + pi
 		theta = arccos(-y)
 	*/
-	static auto getSphereUV(const Point3& p, double& u, double& v) -> void {
+	static auto getSphereUV(const Point3& p, Real& u, Real& v) -> void {
 		auto theta = acos(-p.y());
 		auto phi = atan2(-p.z(), p.x()) + pi;
 		u = phi / (2 * pi);
@@ -83,7 +87,7 @@ private:
 		b in this equations has a factor of 2, taking b = 2h,
 		(-b +- sqrt(b^2 - 4*a*c)) / (2*a) -> (-h +- sqrt(h^2 - a*c)) / a
 */
-auto Sphere::hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool {
+auto Sphere::intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool {
 	Point3 center = this->isMoving
 		? this->center(r.time()) : this->center1;
 	Vec3 oc = r.origin() - center;						// A-C
@@ -101,11 +105,16 @@ auto Sphere::hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool {
 		if (!rayT.surrounds(root))
 			return false;								// hit occurs but not within tMin-tMax window
 	}
-	rec.t = root;
+	rec.setHit(root, this);
+	return true;
+}
+// the point, normal and texture coordinates (an acos and an atan2) only for the closest hit
+auto Sphere::finalize(const Ray& r, HitRecord& rec) const -> void {
+	Point3 center = this->isMoving
+		? this->center(r.time()) : this->center1;
 	rec.p = r.at(rec.t);
 	Vec3 outwardNormal = (rec.p - center) / radius;// normal is in direction of P (hit point/root) - C (center) (points at P from C)
 	rec.setFaceNormal(r, outwardNormal);
 	getSphereUV(outwardNormal, rec.u, rec.v);
 	rec.material = this->material;
-	return true;
 }
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "common.hpp"
+#include "Hittable.hpp"
+#include "Sphere.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+#include "LightList.hpp"
+#include "SimdLanes.hpp"
+
+#include <bit>
+#include <vector>
+
+/*
+	Many spheres as one Hittable. Instead of a Sphere object each (center, motion, radius, material
+	and box behind a virtual call), the set keeps its spheres field by field (structure of arrays) under a
+	BVH of its own whose leaves hold up to width spheres, 4 for double and 8 for float.
+	Every leaf gets a block of its own: x of each of its spheres' centers, then y, z and the radii, then
+	the motion, so a leaf is a handful of aligned loads out of two or three cache lines and one SIMD pass.
+	Lane i solves Sphere::hit's quadratic for sphere i of the block, with the same arithmetic in the same
+	order, so its root is exactly the one the Sphere would find. Only the closest root gets a HitRecord.
+	Moving spheres store their motion (center2 - center1) and are moved to the ray's time in the same pass,
+	a set without any skips that part. A sphere keeps its material's handle.
+
+	Spheres are added first, build then sorts them into blocks in the BVH's leaf order.
+*/
+class SphereSet : public Hittable {
+	static constexpr int width = SimdLanes<Real>::width;
+
+	// one leaf's spheres, slots past the leaf's count unused
+	struct Block {
+		alignas(32) Real center[3][width];	// center1
+		Real radius[width];
+		Real motion[3][width];				// center2 - center1
+		MaterialHandle material[width];
+	};
+	struct Added {
+		Point3 center1;
+		Vec3 motion;
+		Real radius;
+		MaterialHandle material;
+	};
+
+	std::vector<Block> blocks;
+	std::vector<Added> added;		// only kept until build
+	size_t count = 0;
+	bool moving = false;			// any sphere with motion
+	BoundingVolumeHierarchyTree tree;
+
+	/*
+		Closest of the first n spheres of block r hits within rT: sphere as block * width + lane, and its t.
+	*/
+	auto intersectLeaf(uint32_t block, uint32_t n, const Ray& r, const Interval& rT, uint32_t& closest, Real& closestT) const -> bool {
+		const auto& b = this->blocks[block];
+		auto origin = r.origin();
+		auto direction = r.direction();
+		SimdLanes<Real> oc[3]; // A - C
+		for (int a = 0; a < 3; a++) {
+			auto c = SimdLanes<Real>::load(b.center[a]);
+			if (this->moving) c = c + SimdLanes<Real>(r.time()) * SimdLanes<Real>::load(b.motion[a]);
+			oc[a] = SimdLanes<Real>(origin[a]) - c;
+		}
+		SimdLanes<Real> a(direction.lengthSquared());
+		auto halfB = oc[0] * SimdLanes<Real>(direction[0]) + oc[1] * SimdLanes<Real>(direction[1]) + oc[2] * SimdLanes<Real>(direction[2]);
+		auto rr = SimdLanes<Real>::load(b.radius);
+		auto c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - rr * rr;
+		auto underRadical = halfB * halfB - a * c;
+		auto roots = ~lessThan(underRadical, SimdLanes<Real>(0)).bits() & ((1u << n) - 1);
+		if (!roots) return false; // the usual case, and it skips the square root and divisions
+		auto radical = sqrt(underRadical); // NaN in lanes without roots, those stay masked off
+		auto negativeHalfB = SimdLanes<Real>(-0.0) - halfB; // exactly -halfB, signed zeros included
+		auto near = (negativeHalfB - radical) / a;
+		auto far = (negativeHalfB + radical) / a;
+		SimdLanes<Real> tMin(rT.min), tMax(rT.max);
+		auto nearIn = greaterThan(near, tMin).bits() & lessThan(near, tMax).bits();
+		auto farIn = greaterThan(far, tMin).bits() & lessThan(far, tMax).bits();
+		auto lanes = roots & (nearIn | farIn);
+		if (!lanes) return false;
+		alignas(32) Real nearT[width];
+		alignas(32) Real farT[width];
+		near.store(nearT);
+		far.store(farT);
+		closestT = rT.max;
+		for (auto m = lanes; m; m &= m - 1) {
+			auto lane = std::countr_zero(m);
+			auto t = ((nearIn >> lane) & 1) ? nearT[lane] : farT[lane];
+			if (t < closestT) {
+				closestT = t;
+				closest = block * width + lane;
+			}
+		}
+		return true;
+	}
+	/*
+		The packet side of the same test, turned around: one sphere of the block at a time against every lane
+		of the packet at once, lane by lane the same arithmetic again. Hits pull the lanes' tMax in as they go.
+		direction, lengthSquared and time hold the packet's rays transposed, as RayPacket holds their origins.
+	*/
+	struct PacketRays {
+		alignas(32) Real direction[3][width];
+		alignas(32) Real lengthSquared[width];
+		alignas(32) Real time[width];
+	};
+	auto intersectLeaf(uint32_t block, uint32_t n, const RayPacket& packet, const PacketRays& rays, uint32_t lanes, PacketHitRecord& hits) const -> void {
+		const auto& b = this->blocks[block];
+		SimdLanes<Real> origin[3], direction[3];
+		for (int a = 0; a < 3; a++) {
+			origin[a] = SimdLanes<Real>::load(packet.origin[a]);
+			direction[a] = SimdLanes<Real>::load(rays.direction[a]);
+		}
+		auto a = SimdLanes<Real>::load(rays.lengthSquared);
+		auto time = SimdLanes<Real>::load(rays.time);
+		SimdLanes<Real> tMin(packet.tMin);
+		for (uint32_t sphere = 0; sphere < n; sphere++) {
+			SimdLanes<Real> oc[3];
+			for (int axis = 0; axis < 3; axis++) {
+				SimdLanes<Real> c(b.center[axis][sphere]);
+				if (this->moving) c = c + time * SimdLanes<Real>(b.motion[axis][sphere]);
+				oc[axis] = origin[axis] - c;
+			}
+			auto halfB = oc[0] * direction[0] + oc[1] * direction[1] + oc[2] * direction[2];
+			auto rr = SimdLanes<Real>(b.radius[sphere]) * SimdLanes<Real>(b.radius[sphere]);
+			auto c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - rr;
+			auto underRadical = halfB * halfB - a * c;
+			auto roots = ~lessThan(underRadical, SimdLanes<Real>(0)).bits() & lanes;
+			if (!roots) continue;
+			auto radical = sqrt(underRadical);
+			auto negativeHalfB = SimdLanes<Real>(-0.0) - halfB;
+			auto near = (negativeHalfB - radical) / a;
+			auto far = (negativeHalfB + radical) / a;
+			auto tMax = SimdLanes<Real>::load(hits.tMax);
+			auto nearIn = greaterThan(near, tMin).bits() & lessThan(near, tMax).bits();
+			auto farIn = greaterThan(far, tMin).bits() & lessThan(far, tMax).bits();
+			auto hitLanes = roots & (nearIn | farIn);
+			if (!hitLanes) continue;
+			alignas(32) Real nearT[width];
+			alignas(32) Real farT[width];
+			near.store(nearT);
+			far.store(farT);
+			for (auto m = hitLanes; m; m &= m - 1) {
+				auto lane = std::countr_zero(m);
+				auto t = ((nearIn >> lane) & 1) ? nearT[lane] : farT[lane];
+				hits.tMax[lane] = t;
+				hits.hitMask |= 1u << lane;
+				hits.records[lane].setHit(t, this, block * width + sphere);
+			}
+		}
+	}
+	auto fillRecord(uint32_t sphere, const Ray& r, HitRecord& rec) const -> void {
+		const auto& b = this->blocks[sphere / width];
+		auto lane = sphere % width;
+		Point3 center(b.center[0][lane], b.center[1][lane], b.center[2][lane]);
+		if (this->moving) center = center + r.time() * Vec3(b.motion[0][lane], b.motion[1][lane], b.motion[2][lane]);
+		rec.p = r.at(rec.t);
+		Vec3 outwardNormal = (rec.p - center) / b.radius[lane];
+		rec.setFaceNormal(r, outwardNormal);
+		Sphere::getSphereUV(outwardNormal, rec.u, rec.v);
+		rec.material = b.material[lane];
+	}
+
+public:
+	/*
+		BVH options for a set: leaves of up to width spheres, which cost one SIMD test whatever their count,
+		so the SAH sees a sphere as 1 / width of an intersection and never splits a leaf's worth any further.
+	*/
+	static auto defaultOptions() -> BoundingVolumeHierarchyOptions {
+		BoundingVolumeHierarchyOptions options;
+		options.maxLeafSize = width;
+		options.intersectionCost = 1.0 / width;
+		return options;
+	}
+
+	// stationary sphere
+	auto add(const Point3& center, Real radius, shared_ptr<Material> material) -> void {
+		this->add(center, center, radius, material);
+	}
+	// sphere moving from center1 at time 0 to center2 at time 1
+	auto add(const Point3& center1, const Point3& center2, Real radius, shared_ptr<Material> material) -> void {
+		auto motion = center2 - center1;
+		this->moving = this->moving || motion.x() != 0 || motion.y() != 0 || motion.z() != 0;
+		this->added.push_back(Added{ center1, motion, radius, sceneMaterials.add(material) });
+		this->count++;
+	}
+	/*
+		Build the BVH over everything added and pack the spheres into one block per leaf. Call once, after the last add.
+	*/
+	auto build(BoundingVolumeHierarchyOptions options = SphereSet::defaultOptions()) -> void {
+		options.maxLeafSize = std::min(options.maxLeafSize, width); // a leaf has to fit in one block
+		auto boxOf = [this](size_t i) {
+			const auto& s = this->added[i];
+			auto rVec = Vec3(s.radius, s.radius, s.radius);
+			auto center2 = s.center1 + s.motion;
+			return AxisAlignedBoundingBox(
+				AxisAlignedBoundingBox(s.center1 - rVec, s.center1 + rVec), AxisAlignedBoundingBox(center2 - rVec, center2 + rVec)
+			);
+		};
+		auto order = this->tree.build(this->count, boxOf, options, "spheres", this->count * sizeof(Block) / width);
+		this->blocks.reserve(this->count / 2 + 1);
+		this->tree.remapLeaves([&](uint32_t first, uint32_t n) {
+			auto index = static_cast<uint32_t>(this->blocks.size());
+			auto& b = this->blocks.emplace_back(Block{});
+			for (uint32_t lane = 0; lane < n; lane++) {
+				const auto& s = this->added[order[first + lane]];
+				for (int a = 0; a < 3; a++) {
+					b.center[a][lane] = s.center1[a];
+					b.motion[a][lane] = s.motion[a];
+				}
+				b.radius[lane] = s.radius;
+				b.material[lane] = s.material;
+			}
+			return index;
+		});
+		this->blocks.shrink_to_fit();
+		this->added = {};
+	}
+
+	auto intersect(const Ray& r, Interval rT, HitRecord& rec) const -> bool override {
+		uint32_t closest = 0;
+		Real closestT = 0;
+		auto found = this->tree.hit(r, rT, [&](uint32_t block, uint32_t n, Interval& leafT) {
+			if (!this->intersectLeaf(block, n, r, leafT, closest, closestT)) return false;
+			leafT.max = closestT;
+			return true;
+		});
+		if (!found) return false;
+		rec.setHit(closestT, this, closest);
+		return true;
+	}
+	auto occluded(const Ray& r, Interval rT) const -> bool override {
+		return this->tree.occluded(r, rT, [&](uint32_t block, uint32_t n, const Interval& leafT) {
+			uint32_t closest;
+			Real closestT;
+			return this->intersectLeaf(block, n, r, leafT, closest, closestT);
+		});
+	}
+	auto finalize(const Ray& r, HitRecord& rec) const -> void override {
+		this->fillRecord(rec.primitive, r, rec);
+	}
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		for (uint32_t block = 0; block < this->blocks.size(); block++) {
+			const auto& b = this->blocks[block];
+			for (int lane = 0; lane < width; lane++) // unused slots have radius 0, which addSphere passes over
+				lights.addSphere(this, block * width + lane, path, Point3(b.center[0][lane], b.center[1][lane], b.center[2][lane]),
+					Vec3(b.motion[0][lane], b.motion[1][lane], b.motion[2][lane]), b.radius[lane], b.material[lane]);
+		}
+	}
+	auto intersectPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void override {
+		PacketRays rays;
+		for (int lane = 0; lane < width; lane++) {
+			const auto& r = packet.rays[lane < packet.count ? lane : 0]; // idle lanes repeat lane 0, as in RayPacket
+			auto direction = r.direction();
+			for (int a = 0; a < 3; a++)
+				rays.direction[a][lane] = direction[a];
+			rays.lengthSquared[lane] = direction.lengthSquared();
+			rays.time[lane] = r.time();
+		}
+		this->tree.hitPacket(packet, mask, hits, [&](uint32_t block, uint32_t n, uint32_t lanes) {
+			this->intersectLeaf(block, n, packet, rays, lanes, hits);
+		});
+	}
+	auto boundingBox() const -> AxisAlignedBoundingBox override {
+		return this->tree.boundingBox();
+	}
+	auto size() const -> size_t {
+		return this->count;
+	}
+};
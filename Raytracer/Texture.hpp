@@ -8,7 +8,7 @@
 struct Texture {
 	virtual ~Texture() = default;
 
-	virtual auto value(double u, double v, const Point3& p) const -> Color = 0;
+	virtual auto value(Real u, Real v, const Point3& p) const -> Color = 0;
 };
 
 class SolidColor : public Texture {
@@ -16,29 +16,29 @@ class SolidColor : public Texture {
 
 public:
 	SolidColor(Color c) : colorValue(c) {};
-	SolidColor(double red, double green, double blue) : SolidColor(Color(red, green, blue)) {}
+	SolidColor(Real red, Real green, Real blue) : SolidColor(Color(red, green, blue)) {}
 
-	auto value(double u, double v, const Point3& p) const -> Color override {
+	auto value(Real u, Real v, const Point3& p) const -> Color override {
 		return this->colorValue;
 	}
 };
 
 class CheckerTexture : public Texture {
-	double invScale;
+	Real invScale;
 	shared_ptr<Texture> even;
 	shared_ptr<Texture> odd;
 
 public:
-	CheckerTexture(double _scale, shared_ptr<Texture> _even, shared_ptr<Texture> _odd) :
+	CheckerTexture(Real _scale, shared_ptr<Texture> _even, shared_ptr<Texture> _odd) :
 		invScale(1.0 / _scale),
 		even(_even),
 		odd(_odd) {}
-	CheckerTexture(double _scale, Color c1, Color c2) :
+	CheckerTexture(Real _scale, Color c1, Color c2) :
 		invScale(1.0 / _scale),
 		even(make_shared<SolidColor>(c1)),
 		odd(make_shared<SolidColor>(c2)) {}
 
-	auto value(double u, double v, const Point3& p) const -> Color override {
+	auto value(Real u, Real v, const Point3& p) const -> Color override {
 		auto xInt = static_cast<int>(std::floor(invScale * p.x()));
 		auto yInt = static_cast<int>(std::floor(invScale * p.y()));
 		auto zInt = static_cast<int>(std::floor(invScale * p.z()));
@@ -53,7 +53,7 @@ class ImageTexture : public Texture {
 public:
 	ImageTexture(const char* filename) : image(filename) {}
 
-	auto value(double u, double v, const Point3& p) const -> Color override {
+	auto value(Real u, Real v, const Point3& p) const -> Color override {
 		if (this->image.height() <= 0) return Color(0, 1, 1); // cyan debug aid for no texture data
 		// Clamp input texture coordinates to [0, 1] x [1, 0]
 		u = Interval(0, 1).clamp(u);
@@ -69,11 +69,11 @@ public:
 
 class NoiseTexture : public Texture {
 	Perlin noise;
-	double scale;
+	Real scale;
 
 public:
-	NoiseTexture(double sc) : scale(sc) {}
-	auto value(double u, double v, const Point3& p) const -> Color override {
+	NoiseTexture(Real sc) : scale(sc) {}
+	auto value(Real u, Real v, const Point3& p) const -> Color override {
 		auto s = this->scale * p;
 		return Color(1, 1, 1) * 0.5 * (1.0 + sin(s.z() + 10 * this->noise.turbulence(s)));
 	}
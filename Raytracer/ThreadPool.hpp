@@ -1,89 +1,165 @@
 #pragma once
 
 #include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
-#include <queue>
 #include <functional>
 #include <condition_variable>
 
+/*
+	Work stealing thread pool.
+	Every worker owns a deque of tasks. A worker pops from the front of its own deque and, once that
+	runs dry, steals from the back of the other workers' deques. Work queued onto a specific worker
+	(ie, a run of neighbouring image tiles) stays on that core until someone else runs out and steals
+	the far end of it.
+	Workers are spawned once and live until the pool is destroyed, so a whole frame (or build) is fed
+	through one set of threads instead of re-creating them for every batch of work.
+*/
 class ThreadPool {
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
 	const unsigned int numberOfThreads;
-	bool shouldTerminate;
-	std::mutex queueMutex;
-	std::condition_variable mutexCondition;
+	std::atomic<bool> shouldTerminate;
+	std::atomic<long> queuedTasks;			// tasks sitting in a deque, can briefly dip below 0 while a push is in flight
+	std::atomic<long> pendingTasks;			// tasks queued or running
+	std::atomic<unsigned int> nextQueue;	// round robin target for tasks without a preferred worker
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::mutex sleepMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
 	std::vector<std::thread> threads;
-	std::queue<std::function<void()>> tasks;
 
-	auto threadLoop() -> void;
+	auto threadLoop(unsigned int) -> void;
+	auto popTask(unsigned int, std::function<void()>&) -> bool;
+	auto finishTask() -> void;
 
 public:
 	ThreadPool(const unsigned int);
+	auto size() const -> unsigned int;
 	auto queueTask(const std::function<void()>&) -> void;
-	auto unassingedTasks() -> std::queue<std::function<void()>>::size_type;
+	auto queueTask(unsigned int, const std::function<void()>&) -> void;
 	auto busy() -> bool;
+	auto wait() -> void;
 	~ThreadPool();
 };
 
 ThreadPool::ThreadPool(const unsigned int numbOfThreads = std::thread::hardware_concurrency()) :
 	numberOfThreads(numbOfThreads != 0 ? numbOfThreads : 4),
 	shouldTerminate(false),
-	threads(std::vector<std::thread>()),
-	tasks(std::queue<std::function<void()>>())
+	queuedTasks(0),
+	pendingTasks(0),
+	nextQueue(0),
+	threads(std::vector<std::thread>())
 {
+	this->queues.reserve(this->numberOfThreads);
+	for (unsigned int i = 0; i < this->numberOfThreads; i++)
+		this->queues.push_back(std::make_unique<WorkerQueue>());
 	this->threads.reserve(this->numberOfThreads);
 	for (unsigned int i = 0; i < this->numberOfThreads; i++)
 		this->threads.push_back(
 			std::thread(
-				[this]() { this->threadLoop(); }
+				[this, i]() { this->threadLoop(i); }
 			)
 		);
 }
 
-auto ThreadPool::threadLoop() -> void {
+auto ThreadPool::threadLoop(unsigned int index) -> void {
 	while (true) {
 		std::function<void()> task;
-		{
-			std::unique_lock<std::mutex> lock(this->queueMutex);
-			this->mutexCondition.wait(lock, [this] {
-				return !this->tasks.empty() || this->shouldTerminate;
-			});
-			if (this->shouldTerminate) return;
-			task = this->tasks.front();
-			this->tasks.pop();
+		if (this->popTask(index, task)) {
+			task();
+			this->finishTask();
+			continue;
 		}
-		task();
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
+		this->workAvailable.wait(lock, [this] {
+			return this->queuedTasks > 0 || this->shouldTerminate;
+		});
+		if (this->shouldTerminate) return;
 	}
 }
+/*
+	Own deque first (front, where the owner's next neighbouring task is), then
+	steal from the back of everyone else's, walking away from this worker's index.
+*/
+auto ThreadPool::popTask(unsigned int index, std::function<void()>& task) -> bool {
+	for (unsigned int k = 0; k < this->numberOfThreads; k++) {
+		auto& queue = *this->queues[(index + k) % this->numberOfThreads];
+		std::unique_lock<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) continue;
+		if (k == 0) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		else {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		this->queuedTasks--;
+		return true;
+	}
+	return false;
+}
+auto ThreadPool::finishTask() -> void {
+	if (this->pendingTasks.fetch_sub(1) == 1) {
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
+		this->allDone.notify_all();
+	}
+}
+auto ThreadPool::size() const -> unsigned int {
+	return this->numberOfThreads;
+}
 auto ThreadPool::queueTask(const std::function<void()>& task) -> void {
+	this->queueTask(this->nextQueue++, task);
+}
+auto ThreadPool::queueTask(unsigned int worker, const std::function<void()>& task) -> void {
+	this->pendingTasks++;
 	{
-		std::unique_lock<std::mutex> lock(this->queueMutex);
-		this->tasks.push(task);
+		auto& queue = *this->queues[worker % this->numberOfThreads];
+		std::unique_lock<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
 	}
-	this->mutexCondition.notify_one();
-}
-auto ThreadPool::unassingedTasks() -> std::queue<std::function<void()>>::size_type {
-	std::queue<std::function<void()>>::size_type len;
 	{
-		std::unique_lock<std::mutex> lock(this->queueMutex);
-		len = this->tasks.size();
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
+		this->queuedTasks++;
 	}
-	return len;
+	this->workAvailable.notify_one();
 }
 auto ThreadPool::busy() -> bool {
-	bool poolBusy;
-	{
-		std::unique_lock<std::mutex> lock(this->queueMutex);
-		poolBusy = !this->tasks.empty();
-	}
-	return poolBusy;
+	return this->pendingTasks > 0;
+}
+auto ThreadPool::wait() -> void { // blocks until every queued task has finished running
+	std::unique_lock<std::mutex> lock(this->sleepMutex);
+	this->allDone.wait(lock, [this] {
+		return this->pendingTasks == 0;
+	});
 }
 
 ThreadPool::~ThreadPool() {
 	{
-		std::unique_lock<std::mutex> lock(this->queueMutex);
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
 		this->shouldTerminate = true;
 	}
-	this->mutexCondition.notify_all();
+	this->workAvailable.notify_all();
 	for (std::thread& activeThread : this->threads)
 		activeThread.join();
 }
+
+/*
+	Split [0, count) into chunks of chunkSize and run body(begin, end) for each chunk on the pool.
+	Returns once the pool has drained.
+*/
+inline auto parallelFor(ThreadPool& pool, size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& body) -> void {
+	chunkSize = chunkSize > 0 ? chunkSize : 1;
+	for (size_t begin = 0; begin < count; begin += chunkSize) {
+		auto end = begin + chunkSize < count ? begin + chunkSize : count;
+		pool.queueTask([&body, begin, end]() { body(begin, end); });
+	}
+	pool.wait();
+}
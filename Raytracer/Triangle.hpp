@@ -2,6 +2,7 @@
 
 #include "common.hpp"
 #include "Hittable.hpp"
+#include "LightList.hpp"
 #include "AxisAlignedBoundingBox.hpp"
 
 /*
@@ -25,15 +26,15 @@
 class Triangle : public Hittable {
 	Point3 Q;
 	Vec3 u, v;
-	shared_ptr<Material> mat;
+	MaterialHandle mat;
 	AxisAlignedBoundingBox bbox;
 	Vec3 normal;
-	double D;
+	Real D;
 	Vec3 w;
 
 public:
 	Triangle(const Point3& _q, const Vec3& _u, const Vec3& _v, shared_ptr<Material> m)
-		: Q(_q), u(_u), v(_v), mat(m)
+		: Q(_q), u(_u), v(_v), mat(sceneMaterials.add(m))
 	{
 		auto n = cross(u, v); // create a vector normal to u and v
 		this->normal = unitVector(n);
@@ -43,7 +44,8 @@ public:
 	}
 
 	virtual auto setBoundingBox() -> void {
-		this->bbox = AxisAlignedBoundingBox(Q, Q + u + v).pad(); // bounding box has to be square, so wrong >= half the time cause box v triangle
+		// box around the three corners Q, Q + u and Q + v (Q + u + v is the parallelogram's fourth corner, not the triangle's)
+		this->bbox = AxisAlignedBoundingBox(AxisAlignedBoundingBox(Q, Q + u), AxisAlignedBoundingBox(Q, Q + v)).pad();
 	}
 	auto boundingBox() const -> AxisAlignedBoundingBox override {
 		return this->bbox;
@@ -74,7 +76,7 @@ public:
 			a = w . (p x v)
 			b = w . (u x p)
 	*/
-	auto hit(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
+	auto intersect(const Ray& r, Interval rayT, HitRecord& rec) const -> bool override {
 		// check if parallel, because no intersection possible so can end
 		auto denom = dot(this->normal, r.direction()); // n . d
 		if (fabs(denom) < 1e-8) return false;
@@ -89,13 +91,18 @@ public:
 		auto b = dot(this->w, cross(this->u, planeHitPointVector));
 		if (!isInterior(a, b, rec))
 			return false; // was not inside triangle
-		rec.t = t;
-		rec.p = intersection;
+		rec.setHit(t, this);
+		return true;
+	}
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		lights.addTriangle(this, 0, path, this->Q, this->u, this->v, this->mat);
+	}
+	auto finalize(const Ray& r, HitRecord& rec) const -> void override {
+		rec.p = r.at(rec.t);
 		rec.material = this->mat;
 		rec.setFaceNormal(r, this->normal);
-		return true;
 	}
-	virtual auto isInterior(double a, double b, HitRecord& rec) const -> bool {
+	virtual auto isInterior(Real a, Real b, HitRecord& rec) const -> bool {
 		if (a < 0 || b < 0 || a + b > 1) // if a or b is negative, definite miss. if a + b <= 1, hit
 			return false; // not inside
 		rec.u = a;
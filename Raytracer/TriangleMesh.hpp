@@ -0,0 +1,374 @@
+#pragma once
+
+#include "common.hpp"
+#include "Hittable.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+#include "LightList.hpp"
+#include "MeshLoader.hpp"
+#include "ContentHash.hpp"
+#include "MappedFile.hpp"
+
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <span>
+
+/*
+	Many triangles sharing one material, vertex buffers and a BVH of their own. A triangle is three
+	indices into the shared buffers rather than a Hittable of its own, so a million triangle model is a
+	handful of arrays instead of a million heap objects and virtual calls.
+	The mesh is one object to the scene, its own BVH is walked inside hit. Triangles are stored in that
+	BVH's leaf order.
+
+	Intersection is Moller-Trumbore: with edges e1 = p1 - p0, e2 = p2 - p0, the hit point
+		o + t d = (1 - b1 - b2) p0 + b1 p1 + b2 p2
+	is a 3x3 linear system in (t, b1, b2), solved by Cramer's rule with
+		P = d x e2, T = o - p0, Q = T x e1, det = e1 . P
+		b1 = (T . P) / det, b2 = (d . Q) / det, t = (e2 . Q) / det
+	bailing out as soon as b1 or b2 falls outside the triangle. The surface (point, normal, uv)
+	is only worked out once, for the closest triangle the ray hits.
+	Which side was hit, and so which side rays leaving the hit start from, goes by the face normal
+	(counter-clockwise winding faces out). Vertex normals, when the mesh has them, are interpolated across
+	the triangle for shading only: on a coarse mesh they can lean across the face itself. Without texture
+	coordinates u, v are b1, b2.
+
+	A built mesh can be saved to a cache file and mapped back on the next run (see cached): buffers and
+	BVH nodes are stored exactly as they sit in memory, so loading is an mmap, a header check and one pass
+	making sure every index and BVH node points somewhere real, with no parsing, no copying and no build.
+	The file is native byte order and tied to the build that wrote it:
+		CacheHeader, then each of positions, normals, uvs, indices, normalIndices, uvIndices and the
+		BVH nodes at a 64 byte aligned offset
+*/
+class TriangleMesh : public Hittable {
+	MeshData storage;					// buffers of a mesh built here, empty when they are mapped from a cache
+	shared_ptr<MappedFile> cacheFile;	// what the buffers and BVH nodes are mapped from, if they are
+	std::span<const Point3> positions;
+	std::span<const Vec3> normals;
+	std::span<const Real> uvs;					// u, v pairs
+	std::span<const uint32_t> indices;			// 3 per triangle, in BVH leaf order
+	std::span<const uint32_t> normalIndices;	// empty, or 3 per triangle
+	std::span<const uint32_t> uvIndices;		// empty, or 3 per triangle
+	MaterialHandle mat;
+	BoundingVolumeHierarchyTree tree;
+
+	static constexpr int cacheArrays = 7;
+	struct CacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t byteOrder;		// byteOrderMark as the writer stored it
+		uint32_t realSize;		// sizeof(Real)
+		uint64_t nodeSize;		// BoundingVolumeHierarchyTree::nodeSize
+		uint64_t key;			// ContentHash of what the mesh was made from
+		uint64_t offsets[cacheArrays];
+		uint64_t sizes[cacheArrays];	// in bytes
+		double lower[3], upper[3];		// BVH bounds
+	};
+	static constexpr uint32_t cacheMagic = 0x434D5452; // "RTMC"
+	static constexpr uint32_t cacheVersion = 1;
+	static constexpr uint32_t byteOrderMark = 0x01020304;
+	static constexpr size_t cacheAlignment = 64;
+
+	TriangleMesh(shared_ptr<Material> m) : mat(sceneMaterials.add(m)) {}
+
+	auto vertex(uint32_t triangle, int corner) const -> const Point3& {
+		return this->positions[this->indices[3 * triangle + corner]];
+	}
+	auto triangleBox(uint32_t triangle) const -> AxisAlignedBoundingBox {
+		auto box = AxisAlignedBoundingBox(this->vertex(triangle, 0), this->vertex(triangle, 1));
+		return AxisAlignedBoundingBox(box, AxisAlignedBoundingBox(this->vertex(triangle, 2), this->vertex(triangle, 2))).pad();
+	}
+	// t of r hitting the triangle within rT, and its barycentrics b1, b2
+	auto intersectTriangle(uint32_t triangle, const Ray& r, const Interval& rT, Real& t, Real& b1, Real& b2) const -> bool {
+		const auto& p0 = this->vertex(triangle, 0);
+		auto e1 = this->vertex(triangle, 1) - p0;
+		auto e2 = this->vertex(triangle, 2) - p0;
+		auto P = cross(r.direction(), e2);
+		auto det = dot(e1, P);
+		if (det == 0) return false; // ray parallel to the triangle's plane
+		auto inverseDet = 1 / det;
+		auto T = r.origin() - p0;
+		b1 = dot(T, P) * inverseDet;
+		if (b1 < 0 || b1 > 1) return false;
+		auto Q = cross(T, e1);
+		b2 = dot(r.direction(), Q) * inverseDet;
+		if (b2 < 0 || b1 + b2 > 1) return false;
+		t = dot(e2, Q) * inverseDet;
+		return rT.surrounds(t);
+	}
+	auto fillRecord(uint32_t triangle, const Ray& r, Real b1, Real b2, HitRecord& rec) const -> void {
+		auto b0 = 1 - b1 - b2;
+		rec.p = r.at(rec.t);
+		rec.material = this->mat;
+		const auto& p0 = this->vertex(triangle, 0);
+		rec.setFaceNormal(r, unitVector(cross(this->vertex(triangle, 1) - p0, this->vertex(triangle, 2) - p0)));
+		if (!this->normalIndices.empty()) { // interpolated normals can lean across the face, so they only shade
+			const auto* n = &this->normalIndices[3 * triangle];
+			rec.setShadingNormal(unitVector(b0 * this->normals[n[0]] + b1 * this->normals[n[1]] + b2 * this->normals[n[2]]));
+		}
+		if (!this->uvIndices.empty()) {
+			const auto* uv = &this->uvIndices[3 * triangle];
+			rec.u = b0 * this->uvs[2 * uv[0]] + b1 * this->uvs[2 * uv[1]] + b2 * this->uvs[2 * uv[2]];
+			rec.v = b0 * this->uvs[2 * uv[0] + 1] + b1 * this->uvs[2 * uv[1] + 1] + b2 * this->uvs[2 * uv[2] + 1];
+		}
+		else {
+			rec.u = b1;
+			rec.v = b2;
+		}
+	}
+	template <typename T>
+	static auto reorder(std::vector<T>& values, const std::vector<uint32_t>& order) -> void { // 3 values per triangle
+		if (values.empty()) return;
+		std::vector<T> sorted(values.size());
+		for (size_t i = 0; i < order.size(); i++)
+			for (int corner = 0; corner < 3; corner++)
+				sorted[3 * i + corner] = values[3 * order[i] + corner];
+		values.swap(sorted);
+	}
+	// point the spans at storage
+	auto viewStorage() -> void {
+		this->positions = this->storage.positions;
+		this->normals = this->storage.normals;
+		this->uvs = this->storage.uvs;
+		this->indices = this->storage.indices;
+		this->normalIndices = this->storage.normalIndices;
+		this->uvIndices = this->storage.uvIndices;
+	}
+
+public:
+	TriangleMesh(MeshData&& mesh, shared_ptr<Material> m, const BoundingVolumeHierarchyOptions& options = {}) :
+		storage(std::move(mesh)), mat(sceneMaterials.add(m))
+	{
+		this->viewStorage();
+		auto triangles = this->indices.size() / 3;
+		auto storageBytes = this->positions.size_bytes() + this->normals.size_bytes() + this->uvs.size_bytes()
+			+ this->indices.size_bytes() + this->normalIndices.size_bytes() + this->uvIndices.size_bytes();
+		auto order = this->tree.build(
+			triangles, [this](size_t i) { return this->triangleBox(static_cast<uint32_t>(i)); }, options, "triangles", storageBytes
+		);
+		TriangleMesh::reorder(this->storage.indices, order);
+		TriangleMesh::reorder(this->storage.normalIndices, order);
+		TriangleMesh::reorder(this->storage.uvIndices, order);
+		this->viewStorage();
+	}
+	/*
+		Load an .obj or .ply file into a mesh, null (after printing why) when it can't be read.
+	*/
+	static auto load(const std::string& path, shared_ptr<Material> m, const BoundingVolumeHierarchyOptions& options = {}) -> shared_ptr<TriangleMesh> {
+		auto start = std::chrono::steady_clock::now();
+		MeshData mesh;
+		if (!MeshLoader::load(path, mesh)) return nullptr;
+		std::cout << "Loaded '" << path << "': " << mesh.positions.size() << " vertices, " << mesh.triangleCount() << " triangles in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+		return make_shared<TriangleMesh>(std::move(mesh), m, options);
+	}
+	/*
+		The mesh cachePath holds if it was made from the same inputs, otherwise the one make fills in (null
+		when make fails), which is then written to cachePath for next time. key is the hash of everything
+		make reads (model files, how it transforms them), the BVH options that shape the tree are added here.
+	*/
+	static auto cached(
+		const std::string& cachePath, ContentHash key, shared_ptr<Material> m, const std::function<bool(MeshData&)>& make,
+		const BoundingVolumeHierarchyOptions& options = {}
+	) -> shared_ptr<TriangleMesh> {
+		key.add(options.maxLeafSize).add(options.binCount).add(options.traversalCost).add(options.intersectionCost);
+		if (auto mesh = TriangleMesh::map(cachePath, key.value, m)) return mesh;
+		MeshData data;
+		if (!make(data)) return nullptr;
+		auto mesh = make_shared<TriangleMesh>(std::move(data), m, options);
+		mesh->save(cachePath, key.value); // failing only costs the next run a rebuild
+		return mesh;
+	}
+	/*
+		Map a mesh saved with key, null when there is no such file or it was saved from other inputs or by
+		an incompatible build (saying which, so a rebuild doesn't come as a surprise).
+	*/
+	static auto map(const std::string& path, uint64_t key, shared_ptr<Material> m) -> shared_ptr<TriangleMesh> {
+		auto start = std::chrono::steady_clock::now();
+		auto file = make_shared<MappedFile>();
+		if (!file->open(path)) return nullptr;
+		CacheHeader header;
+		if (file->size() < sizeof(CacheHeader)) {
+			std::cout << "Mesh cache '" << path << "' is not a mesh cache, rebuilding it.\n";
+			return nullptr;
+		}
+		std::memcpy(&header, file->data(), sizeof(CacheHeader));
+		if (header.magic != TriangleMesh::cacheMagic || header.version != TriangleMesh::cacheVersion || header.byteOrder != TriangleMesh::byteOrderMark
+			|| header.realSize != sizeof(Real) || header.nodeSize != BoundingVolumeHierarchyTree::nodeSize) {
+			std::cout << "Mesh cache '" << path << "' was written by a different build, rebuilding it.\n";
+			return nullptr;
+		}
+		if (header.key != key) {
+			std::cout << "Mesh cache '" << path << "' is out of date, rebuilding it.\n";
+			return nullptr;
+		}
+		const size_t elementSizes[cacheArrays] = {
+			sizeof(Point3), sizeof(Vec3), sizeof(Real), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), BoundingVolumeHierarchyTree::nodeSize
+		};
+		for (int i = 0; i < cacheArrays; i++) {
+			if (header.offsets[i] % cacheAlignment != 0 || header.sizes[i] % elementSizes[i] != 0
+				|| header.offsets[i] > file->size() || header.sizes[i] > file->size() - header.offsets[i]) {
+				std::cerr << "ERROR: Mesh cache '" << path << "' is damaged, rebuilding it.\n";
+				return nullptr;
+			}
+		}
+		shared_ptr<TriangleMesh> mesh(new TriangleMesh(m));
+		auto section = [&]<typename T>(std::span<const T>& values, int i) {
+			values = std::span(reinterpret_cast<const T*>(file->data() + header.offsets[i]), header.sizes[i] / sizeof(T));
+		};
+		section(mesh->positions, 0);
+		section(mesh->normals, 1);
+		section(mesh->uvs, 2);
+		section(mesh->indices, 3);
+		section(mesh->normalIndices, 4);
+		section(mesh->uvIndices, 5);
+		mesh->tree.attach(
+			file->data() + header.offsets[6], header.sizes[6] / BoundingVolumeHierarchyTree::nodeSize,
+			AxisAlignedBoundingBox(
+				Interval(header.lower[0], header.upper[0]), Interval(header.lower[1], header.upper[1]), Interval(header.lower[2], header.upper[2])
+			)
+		);
+		// the header only says where things are, what they hold is trusted nowhere else
+		if (!MeshLoader::consistent(
+				mesh->indices, mesh->normalIndices, mesh->uvIndices, mesh->positions.size(), mesh->normals.size(), mesh->uvs.size() / 2
+			) || !mesh->tree.walkable(mesh->triangleCount())) {
+			std::cerr << "ERROR: Mesh cache '" << path << "' is damaged, rebuilding it.\n";
+			return nullptr;
+		}
+		mesh->cacheFile = file;
+		std::cout << "Mapped '" << path << "': " << mesh->positions.size() << " vertices, " << mesh->triangleCount() << " triangles, "
+			<< header.sizes[6] / BoundingVolumeHierarchyTree::nodeSize << " BVH nodes in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+		return mesh;
+	}
+	/*
+		Write the buffers and BVH to path for map, under key. Goes through a temporary file renamed into place,
+		so a run killed mid write (or one mapping the old file) never sees a half written cache.
+	*/
+	auto save(const std::string& path, uint64_t key) const -> bool {
+		const std::span<const std::byte> arrays[cacheArrays] = {
+			std::as_bytes(this->positions), std::as_bytes(this->normals), std::as_bytes(this->uvs), std::as_bytes(this->indices),
+			std::as_bytes(this->normalIndices), std::as_bytes(this->uvIndices), this->tree.nodeBytes()
+		};
+		CacheHeader header{};
+		header.magic = TriangleMesh::cacheMagic;
+		header.version = TriangleMesh::cacheVersion;
+		header.byteOrder = TriangleMesh::byteOrderMark;
+		header.realSize = sizeof(Real);
+		header.nodeSize = BoundingVolumeHierarchyTree::nodeSize;
+		header.key = key;
+		auto align = [](uint64_t offset) { return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment; };
+		uint64_t offset = align(sizeof(CacheHeader));
+		for (int i = 0; i < cacheArrays; i++) {
+			header.offsets[i] = offset;
+			header.sizes[i] = arrays[i].size();
+			offset = align(offset + arrays[i].size());
+		}
+		auto box = this->tree.boundingBox();
+		for (int a = 0; a < 3; a++) {
+			header.lower[a] = box.axis(a).min;
+			header.upper[a] = box.axis(a).max;
+		}
+
+		auto temporaryPath = path + ".tmp";
+		{
+			std::ofstream out(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!out) {
+				std::cerr << "ERROR: Could not open '" << temporaryPath << "' for writing.\n";
+				return false;
+			}
+			const char zeros[cacheAlignment] = {};
+			out.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+			uint64_t written = sizeof(CacheHeader);
+			for (int i = 0; i < cacheArrays; i++) {
+				out.write(zeros, static_cast<std::streamsize>(header.offsets[i] - written));
+				out.write(reinterpret_cast<const char*>(arrays[i].data()), static_cast<std::streamsize>(arrays[i].size()));
+				written = header.offsets[i] + header.sizes[i];
+			}
+			if (!out) {
+				std::cerr << "ERROR: Failed writing '" << temporaryPath << "'.\n";
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		if (error) {
+			std::cerr << "ERROR: Could not replace '" << path << "': " << error.message() << '\n';
+			return false;
+		}
+		return true;
+	}
+
+	auto intersect(const Ray& r, Interval rT, HitRecord& rec) const -> bool override {
+		uint32_t closest = 0;
+		Real closestT = 0, closestB1 = 0, closestB2 = 0;
+		auto found = this->tree.hit(r, rT, [&](uint32_t first, uint32_t count, Interval& leafT) {
+			bool hitAnything = false;
+			for (uint32_t i = first; i < first + count; i++) {
+				Real t, b1, b2;
+				if (this->intersectTriangle(i, r, leafT, t, b1, b2)) {
+					hitAnything = true;
+					leafT.max = t;
+					closest = i;
+					closestT = t;
+					closestB1 = b1;
+					closestB2 = b2;
+				}
+			}
+			return hitAnything;
+		});
+		if (!found) return false;
+		rec.setHit(closestT, this, closest);
+		rec.u = closestB1;
+		rec.v = closestB2;
+		return true;
+	}
+	auto occluded(const Ray& r, Interval rT) const -> bool override {
+		return this->tree.occluded(r, rT, [&](uint32_t first, uint32_t count, const Interval& leafT) {
+			for (uint32_t i = first; i < first + count; i++) {
+				Real t, b1, b2;
+				if (this->intersectTriangle(i, r, leafT, t, b1, b2)) return true;
+			}
+			return false;
+		});
+	}
+	auto finalize(const Ray& r, HitRecord& rec) const -> void override {
+		this->fillRecord(rec.primitive, r, rec.u, rec.v, rec);
+	}
+	// an emissive mesh is a light per triangle
+	auto gatherLights(LightList& lights, const InstancePath& path) const -> void override {
+		if (!LightList::emits(this->mat)) return;
+		for (uint32_t i = 0; i < this->triangleCount(); i++) {
+			const auto& p0 = this->vertex(i, 0);
+			lights.addTriangle(this, i, path, p0, this->vertex(i, 1) - p0, this->vertex(i, 2) - p0, this->mat);
+		}
+	}
+	auto intersectPacket(const RayPacket& packet, uint32_t mask, PacketHitRecord& hits) const -> void override {
+		this->tree.hitPacket(packet, mask, hits, [&](uint32_t first, uint32_t count, uint32_t lanes) {
+			for (auto m = lanes; m; m &= m - 1) {
+				auto lane = std::countr_zero(m);
+				const auto& r = packet.rays[lane];
+				for (uint32_t i = first; i < first + count; i++) {
+					Real t, b1, b2;
+					if (this->intersectTriangle(i, r, Interval(packet.tMin, hits.tMax[lane]), t, b1, b2)) {
+						hits.tMax[lane] = t;
+						hits.hitMask |= 1u << lane;
+						hits.records[lane].setHit(t, this, i);
+						hits.records[lane].u = b1;
+						hits.records[lane].v = b2;
+					}
+				}
+			}
+		});
+	}
+	auto boundingBox() const -> AxisAlignedBoundingBox override {
+		return this->tree.boundingBox();
+	}
+	auto triangleCount() const -> size_t {
+		return this->indices.size() / 3;
+	}
+};
@@ -2,56 +2,71 @@
 
 #include <cmath>
 #include <iostream>
+#include <type_traits>
+
+#include "Vec3Kernel.hpp"
 
 using std::sqrt;
 
-struct Vec3 {
-	double e[3];
+/*
+	3 component vector, templated on its scalar so the whole renderer can be built in single or double
+	precision (see Real in common.hpp). Vec3, Point3 and Color are the Real instantiation.
+	Scalar arguments never take part in template deduction (std::type_identity_t), so
+	0.5 * v compiles for a float vector the same as for a double one.
+	Stored as 4 aligned lanes, the 4th only padding, so the arithmetic (Vec3Kernel.hpp) can load
+	and operate on a whole vector at once.
+*/
+template <typename T>
+struct Vec3T {
+	alignas(4 * sizeof(T)) T e[4];
 
-	Vec3() : e{ 0,0,0 } {}
-	Vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+	Vec3T() : e{ 0,0,0,0 } {}
+	Vec3T(T e0, T e1, T e2) : e{ e0, e1, e2, 0 } {}
+	template <typename U>
+	explicit Vec3T(const Vec3T<U>& other) : e{ static_cast<T>(other.e[0]), static_cast<T>(other.e[1]), static_cast<T>(other.e[2]), 0 } {}
 
-	auto x() const -> double { return e[0]; }
-	auto y() const -> double { return e[1]; }
-	auto z() const -> double { return e[2]; }
+	auto x() const -> T { return e[0]; }
+	auto y() const -> T { return e[1]; }
+	auto z() const -> T { return e[2]; }
 
-	auto operator-() const -> Vec3 { return Vec3(-e[0], -e[1], -e[2]); } // negation
-	auto operator[](int i) const -> double { return e[i]; }
-	auto operator[](int i) -> double& { return e[i]; }
+	auto operator-() const -> Vec3T { // negation
+		Vec3T r;
+		Vec3Kernel<T>::negate(this->e, r.e);
+		return r;
+	}
+	auto operator[](int i) const -> T { return e[i]; }
+	auto operator[](int i) -> T& { return e[i]; }
 
-	auto operator+=(const Vec3& v) -> Vec3& {
-		e[0] += v.e[0];
-		e[1] += v.e[1];
-		e[2] += v.e[2];
+	auto operator+=(const Vec3T& v) -> Vec3T& {
+		Vec3Kernel<T>::add(this->e, v.e, this->e);
 		return *this;
 	}
-	auto operator*=(const double t) -> Vec3& {
-		e[0] *= t;
-		e[1] *= t;
-		e[2] *= t;
+	auto operator*=(const std::type_identity_t<T> t) -> Vec3T& {
+		Vec3Kernel<T>::scale(this->e, t, this->e);
 		return *this;
 	}
-	auto operator/=(const double t) -> Vec3& {
+	auto operator/=(const std::type_identity_t<T> t) -> Vec3T& {
 		return *this *= 1 / t;
 	}
-	auto length() const -> double {
+	auto length() const -> T {
 		return sqrt(lengthSquared());
 	}
-	auto lengthSquared() const -> double{
-		return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+	auto lengthSquared() const -> T {
+		return Vec3Kernel<T>::dot(this->e, this->e);
 	}
 	auto nearZero() const -> bool {
-		const auto s = 1e-8;
+		const T s = static_cast<T>(1e-8);
 		return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
 	}
-	inline static auto random() -> Vec3 {
-		return Vec3(randomDouble(), randomDouble(), randomDouble());
+	inline static auto random() -> Vec3T {
+		return Vec3T(randomDouble(), randomDouble(), randomDouble());
 	}
-	inline static auto random(double min, double max) -> Vec3 {
-		return Vec3(randomDouble(min, max), randomDouble(min, max), randomDouble(min, max));
+	inline static auto random(double min, double max) -> Vec3T {
+		return Vec3T(randomDouble(min, max), randomDouble(min, max), randomDouble(min, max));
 	}
 };
 
+using Vec3 = Vec3T<Real>;
 using Point3 = Vec3;
 
 // Vec3 utilities
@@ -59,38 +74,54 @@ using Point3 = Vec3;
 // Vec3 + Vec3, no diff
 // Vec3 + {0,0,0}, no diff
 // {0,0,0} + Vec3, left side converted to vec3 if these outside, but if member functions, won't be
-inline auto operator<<(std::ostream& out, const Vec3& v) -> std::ostream& {
+template <typename T>
+inline auto operator<<(std::ostream& out, const Vec3T<T>& v) -> std::ostream& {
 	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
-inline auto operator+(const Vec3& u, const Vec3& v) -> Vec3 { // vector addition -> (new)
-	return Vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
-inline auto operator-(const Vec3& u, const Vec3& v) -> Vec3 { // vector subtraction -> (new)
-	return Vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
-inline auto operator*(const Vec3 & u, const Vec3 & v) -> Vec3 { // matrix multiplication -> (new)
-	return Vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
-inline auto operator*(double u, const Vec3& v) -> Vec3 { // scalar multiplication -> (new)
-	return Vec3(u * v.e[0], u * v.e[1], u * v.e[2]);
-}
-inline auto operator*(Vec3 v, double t) -> Vec3 { // scalar multplication (other side) -> (new)
+template <typename T>
+inline auto operator+(const Vec3T<T>& u, const Vec3T<T>& v) -> Vec3T<T> { // vector addition -> (new)
+	Vec3T<T> r;
+	Vec3Kernel<T>::add(u.e, v.e, r.e);
+	return r;
+}
+template <typename T>
+inline auto operator-(const Vec3T<T>& u, const Vec3T<T>& v) -> Vec3T<T> { // vector subtraction -> (new)
+	Vec3T<T> r;
+	Vec3Kernel<T>::sub(u.e, v.e, r.e);
+	return r;
+}
+template <typename T>
+inline auto operator*(const Vec3T<T>& u, const Vec3T<T>& v) -> Vec3T<T> { // matrix multiplication -> (new)
+	Vec3T<T> r;
+	Vec3Kernel<T>::mul(u.e, v.e, r.e);
+	return r;
+}
+template <typename T>
+inline auto operator*(std::type_identity_t<T> u, const Vec3T<T>& v) -> Vec3T<T> { // scalar multiplication -> (new)
+	Vec3T<T> r;
+	Vec3Kernel<T>::scale(v.e, u, r.e);
+	return r;
+}
+template <typename T>
+inline auto operator*(Vec3T<T> v, std::type_identity_t<T> t) -> Vec3T<T> { // scalar multplication (other side) -> (new)
 	return t * v;
 }
-inline auto operator/(Vec3 v, double t) -> Vec3 { // scalar division -> (new)
+template <typename T>
+inline auto operator/(Vec3T<T> v, std::type_identity_t<T> t) -> Vec3T<T> { // scalar division -> (new)
 	return (1 / t) * v;
 }
-inline auto dot(const Vec3& u, const Vec3& v) -> double { // dot product (inner product)
-	return u.e[0] * v.e[0]
-		+ u.e[1] * v.e[1]
-		+ u.e[2] * v.e[2];
+template <typename T>
+inline auto dot(const Vec3T<T>& u, const Vec3T<T>& v) -> T { // dot product (inner product)
+	return Vec3Kernel<T>::dot(u.e, v.e);
 }
-inline auto cross(const Vec3& u, const Vec3& v) -> Vec3 { // cross product (vector product) -> (new)
-	return Vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-		u.e[2] * v.e[0] - u.e[0] * v.e[2],
-		u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline auto cross(const Vec3T<T>& u, const Vec3T<T>& v) -> Vec3T<T> { // cross product (vector product) -> (new)
+	Vec3T<T> r;
+	Vec3Kernel<T>::cross(u.e, v.e, r.e);
+	return r;
 }
-inline auto unitVector(Vec3 v) -> Vec3 { // to unit length -> (new)
+template <typename T>
+inline auto unitVector(Vec3T<T> v) -> Vec3T<T> { // to unit length -> (new)
 	return v / v.length();
 }
 
@@ -117,31 +148,34 @@ auto reflect(const Vec3& v, const Vec3& n) -> Vec3 {
 
 	Ray's inside material with higher refractive index, no solution to snell's law, no refraction
 */
-auto refract(const Vec3& uv, const Vec3& n, double etaiOverEtat) {
-	auto cosTheta = fmin(dot(-uv, n), 1.0);
+auto refract(const Vec3& uv, const Vec3& n, Real etaiOverEtat) {
+	auto cosTheta = fmin(dot(-uv, n), Real(1));
 	Vec3 rOutPerp = etaiOverEtat * (uv + cosTheta * n);
-	Vec3 rOutParallel = -sqrt(fabs(1.0 - rOutPerp.lengthSquared())) * n;
+	Vec3 rOutParallel = -sqrt(fabs(1 - rOutPerp.lengthSquared())) * n;
 	return rOutPerp + rOutParallel;
 }
 
-auto randomInUnitSphere() -> Vec3 {
-	auto rho = randomDouble(0, 1);			// spherical to cartesian avoids while loop by embedding distance in rho alone
-	auto theta = randomDouble(0, 2 * pi);
-	auto phi = randomDouble(0, pi);
+auto randomInUnitSphere(Sampler& sampler) -> Vec3 {
+	auto rho = sampler.next(0, 1);			// spherical to cartesian avoids while loop by embedding distance in rho alone
+	auto theta = sampler.next(0, 2 * pi);
+	auto phi = sampler.next(0, pi);
 	auto p = Vec3(rho * sin(phi) * cos(theta), rho * sin(phi) * sin(theta), rho * cos(phi));
 	return p;
 }
-auto randomInHemisphere(const Vec3& normal) -> Vec3 {
-	Vec3 inUnitSphere = randomInUnitSphere();
+auto randomInHemisphere(const Vec3& normal, Sampler& sampler) -> Vec3 {
+	Vec3 inUnitSphere = randomInUnitSphere(sampler);
 	// in same hemisphere as normal. if dot(inUnitSphere, normal) > 0.0, negate inUnitSphere
 	return inUnitSphere * -(dot(inUnitSphere, normal) > 0.0); // maybe turns into a cmov?
 }
-auto randomInUnitDisk() -> Vec3 {
-	auto theta = randomDouble(0, 2 * pi);	// polar to cartesian avoids while loop by embedding distance in r alone
-	auto r = randomDouble(0, 1);
+auto randomInUnitDisk(Sampler& sampler) -> Vec3 {
+	auto theta = sampler.next(0, 2 * pi);	// polar to cartesian avoids while loop by embedding distance in r alone
+	auto r = sampler.next(0, 1);
 	auto p = Vec3(r * cos(theta), r * sin(theta), 0);
 	return p;
 }
-auto randomUnitVector() -> Vec3 {
-	return unitVector(randomInUnitSphere());
+auto randomUnitVector(Sampler& sampler) -> Vec3 {
+	auto z = sampler.next(-1, 1);			// uniform height is uniform area on the sphere (Archimedes), a uniform angle from the pole would bunch up at the poles
+	auto theta = sampler.next(0, 2 * pi);
+	auto ring = sqrt(fmax(0.0, 1 - z * z));
+	return Vec3(ring * cos(theta), ring * sin(theta), z);
 }
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/*
+	Arithmetic behind Vec3T. A vector is stored as 4 aligned lanes (x, y, z and a padding lane kept at 0),
+	so one vector is one register: __m256d for double (AVX2), __m128 for float (SSE).
+	Every routine works on the lane arrays of its operands. The generic version is plain per component
+	code for targets without AVX2, the specializations do each operation in a couple of instructions.
+	dot only ever adds x, y and z, in that order, so a padding lane gone NaN (0 * inf) never leaks in
+	and results match the scalar code.
+*/
+template <typename T>
+struct Vec3Kernel {
+	static auto add(const T* a, const T* b, T* r) -> void { for (int i = 0; i < 3; i++) r[i] = a[i] + b[i]; }
+	static auto sub(const T* a, const T* b, T* r) -> void { for (int i = 0; i < 3; i++) r[i] = a[i] - b[i]; }
+	static auto mul(const T* a, const T* b, T* r) -> void { for (int i = 0; i < 3; i++) r[i] = a[i] * b[i]; }
+	static auto scale(const T* a, T s, T* r) -> void { for (int i = 0; i < 3; i++) r[i] = a[i] * s; }
+	static auto negate(const T* a, T* r) -> void { for (int i = 0; i < 3; i++) r[i] = -a[i]; }
+	static auto dot(const T* a, const T* b) -> T { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+	static auto cross(const T* a, const T* b, T* r) -> void {
+		r[0] = a[1] * b[2] - a[2] * b[1];
+		r[1] = a[2] * b[0] - a[0] * b[2];
+		r[2] = a[0] * b[1] - a[1] * b[0];
+	}
+};
+
+#if defined(__AVX2__)
+template <>
+struct Vec3Kernel<double> {
+	static auto add(const double* a, const double* b, double* r) -> void { _mm256_store_pd(r, _mm256_add_pd(_mm256_load_pd(a), _mm256_load_pd(b))); }
+	static auto sub(const double* a, const double* b, double* r) -> void { _mm256_store_pd(r, _mm256_sub_pd(_mm256_load_pd(a), _mm256_load_pd(b))); }
+	static auto mul(const double* a, const double* b, double* r) -> void { _mm256_store_pd(r, _mm256_mul_pd(_mm256_load_pd(a), _mm256_load_pd(b))); }
+	static auto scale(const double* a, double s, double* r) -> void { _mm256_store_pd(r, _mm256_mul_pd(_mm256_load_pd(a), _mm256_set1_pd(s))); }
+	static auto negate(const double* a, double* r) -> void { _mm256_store_pd(r, _mm256_xor_pd(_mm256_load_pd(a), _mm256_set1_pd(-0.0))); }
+	static auto dot(const double* a, const double* b) -> double {
+		auto p = _mm256_mul_pd(_mm256_load_pd(a), _mm256_load_pd(b));
+		auto xy = _mm256_castpd256_pd128(p);
+		auto s = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));	// x + y
+		s = _mm_add_sd(s, _mm256_extractf128_pd(p, 1));		// + z
+		return _mm_cvtsd_f64(s);
+	}
+	static auto cross(const double* a, const double* b, double* r) -> void { // a.yzx * b.zxy - a.zxy * b.yzx
+		auto va = _mm256_load_pd(a);
+		auto vb = _mm256_load_pd(b);
+		auto aYZX = _mm256_permute4x64_pd(va, _MM_SHUFFLE(3, 0, 2, 1));
+		auto bZXY = _mm256_permute4x64_pd(vb, _MM_SHUFFLE(3, 1, 0, 2));
+		auto aZXY = _mm256_permute4x64_pd(va, _MM_SHUFFLE(3, 1, 0, 2));
+		auto bYZX = _mm256_permute4x64_pd(vb, _MM_SHUFFLE(3, 0, 2, 1));
+		_mm256_store_pd(r, _mm256_sub_pd(_mm256_mul_pd(aYZX, bZXY), _mm256_mul_pd(aZXY, bYZX)));
+	}
+};
+
+template <>
+struct Vec3Kernel<float> {
+	static auto add(const float* a, const float* b, float* r) -> void { _mm_store_ps(r, _mm_add_ps(_mm_load_ps(a), _mm_load_ps(b))); }
+	static auto sub(const float* a, const float* b, float* r) -> void { _mm_store_ps(r, _mm_sub_ps(_mm_load_ps(a), _mm_load_ps(b))); }
+	static auto mul(const float* a, const float* b, float* r) -> void { _mm_store_ps(r, _mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b))); }
+	static auto scale(const float* a, float s, float* r) -> void { _mm_store_ps(r, _mm_mul_ps(_mm_load_ps(a), _mm_set1_ps(s))); }
+	static auto negate(const float* a, float* r) -> void { _mm_store_ps(r, _mm_xor_ps(_mm_load_ps(a), _mm_set1_ps(-0.0f))); }
+	static auto dot(const float* a, const float* b) -> float {
+		auto p = _mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b));
+		auto s = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));	// x + y
+		s = _mm_add_ss(s, _mm_movehl_ps(p, p));								// + z
+		return _mm_cvtss_f32(s);
+	}
+	static auto cross(const float* a, const float* b, float* r) -> void { // a.yzx * b.zxy - a.zxy * b.yzx
+		auto va = _mm_load_ps(a);
+		auto vb = _mm_load_ps(b);
+		auto aYZX = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+		auto bZXY = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 1, 0, 2));
+		auto aZXY = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 1, 0, 2));
+		auto bYZX = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+		_mm_store_ps(r, _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX)));
+	}
+};
+#endif
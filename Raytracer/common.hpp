@@ -10,6 +10,17 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+/*
+	Scalar of all geometry (Vec3, Ray, Interval, hit records, bounding boxes).
+	Double by default, define RAYTRACER_SINGLE_PRECISION for float, which doubles the lanes of every
+	SIMD test and halves the memory the BVH and scene touch. Accumulated pixel sums stay double either way.
+*/
+#if defined(RAYTRACER_SINGLE_PRECISION)
+using Real = float;
+#else
+using Real = double;
+#endif
+
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.14159265358979323846;
@@ -18,9 +29,14 @@ const double pi = 3.14159265358979323846;
 inline auto degreesToRadians(double degrees) -> double {
 	return degrees * pi / 180.0;
 }
+/*
+	Sequential generator for building scenes (random sphere placement, Perlin tables, ...).
+	Each thread gets its own default seeded generator, so scene construction stays reproducible.
+	Anything that runs per sample during rendering draws from a Sampler instead.
+*/
 inline auto randomDouble() -> double { // returns a random real in [0,1)
-	static std::uniform_real_distribution<double> dist(0, 1.0);
-	static std::mt19937 gen;
+	thread_local std::uniform_real_distribution<double> dist(0, 1.0);
+	thread_local std::mt19937 gen;
 	return dist(gen);
 }
 inline auto randomDouble(double min, double max) -> double { // returns a random real in [min, max)
@@ -31,6 +47,7 @@ inline auto randomInt(int min, int max) -> int {
 }
 
 // Common Headers
+#include "Sampler.hpp"
 #include "Interval.hpp"
 #include "Vec3.hpp"
 #include "Ray.hpp"
@@ -8,6 +8,7 @@
 #include "Color.hpp"
 #include "HittableList.hpp"
 #include "Sphere.hpp"
+#include "SphereSet.hpp"
 #include "Camera.hpp"
 #include "Material.hpp"
 #include "BoundingVolumeHierarchy.hpp"
@@ -16,14 +17,17 @@
 #include "ConstantMedium.hpp"
 #include "BoundingVolumeHierarchy.hpp"
 #include "Triangle.hpp"
+#include "TriangleMesh.hpp"
+#include "RenderOptions.hpp"
 
-auto randomSpheres() -> void {
+auto randomSpheres(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	// World
 	HittableList world;
 
+	auto spheres = make_shared<SphereSet>();
 	auto groundMaterial = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
-	world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
+	spheres->add(Point3(0, -1000, 0), 1000, groundMaterial);
 
 	for (int a = -11; a < 11; a++) {
 		for (int b = -11; b < 11; b++) {
@@ -35,30 +39,31 @@ auto randomSpheres() -> void {
 					auto albedo = Color::random() * Color::random();
 					sphereMat = make_shared<Lambertian>(albedo);
 					auto center2 = center + Vec3(0, randomDouble(0, 0.5), 0);
-					world.add(make_shared<Sphere>(center, center2, 0.2, sphereMat));
+					spheres->add(center, center2, 0.2, sphereMat);
 				}
 				else if (chooseMat < 0.95) { // metal
 					auto albedo = Color::random(0.5, 1);
 					auto fuzz = randomDouble(0, 0.5);
 					sphereMat = make_shared<Metal>(albedo, fuzz);
-					world.add(make_shared<Sphere>(center, 0.2, sphereMat));
+					spheres->add(center, 0.2, sphereMat);
 				}
 				else { // glass
 					sphereMat = make_shared<Dielectric>(1.5);
-					world.add(make_shared<Sphere>(center, 0.2, sphereMat));
+					spheres->add(center, 0.2, sphereMat);
 				}
 			}
 		}
 	}
 
 	auto material1 = make_shared<Dielectric>(1.5);
-	world.add(make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+	spheres->add(Point3(0, 1, 0), 1.0, material1);
 	auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-	world.add(make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+	spheres->add(Point3(-4, 1, 0), 1.0, material2);
 	auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+	spheres->add(Point3(4, 1, 0), 1.0, material3);
 
-	world = HittableList(make_shared<BoundingVolumeHierarchyNode>(world));
+	spheres->build(options.bvhOptions(SphereSet::defaultOptions()));
+	world.add(spheres);
 
 	// Camera
 	Camera cam;
@@ -77,13 +82,15 @@ auto randomSpheres() -> void {
 	cam.defocusAngle = 0.02;
 	cam.focusDistance = 10.0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto twoSpheres() -> void {
+auto twoSpheres(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	HittableList world;
 
@@ -106,12 +113,14 @@ auto twoSpheres() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto earth() -> void {
+auto earth(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	auto earthTexture = make_shared<ImageTexture>("earthmap.jpg");
 	auto earthSurface = make_shared<Lambertian>(earthTexture);
@@ -131,12 +140,14 @@ auto earth() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(HittableList(globe));
+	options.applyTo(cam);
+	auto rendered = cam.render(HittableList(globe));
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto twoPerlinSpheres() -> void {
+auto twoPerlinSpheres(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	HittableList world;
 
@@ -159,12 +170,14 @@ auto twoPerlinSpheres() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto quads() -> void {
+auto quads(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	HittableList world;
 	auto leftRed = make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
@@ -192,12 +205,14 @@ auto quads() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto simpleLight() -> void {
+auto simpleLight(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	HittableList world;
 
@@ -223,12 +238,14 @@ auto simpleLight() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto cornellBox() -> void {
+auto cornellBox(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	HittableList world;
 
@@ -270,12 +287,14 @@ auto cornellBox() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-auto cornellSmoke() -> void {
+auto cornellSmoke(const RenderOptions& options) -> bool {
 	auto start = std::chrono::high_resolution_clock::now();
 	HittableList world;
 
@@ -315,12 +334,239 @@ auto cornellSmoke() -> void {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
 }
 
-void finalScene(int imageWidth, int samplesPerPixel, int maxDepth) {
+/*
+	Cornell box with a loaded model standing on the floor, scaled to fit in the middle of the box.
+*/
+auto meshScene(const RenderOptions& options) -> bool {
+	auto start = std::chrono::high_resolution_clock::now();
+	if (options.meshPath.empty()) {
+		std::cerr << "ERROR: The mesh scene needs a model, pass one with --mesh <file>.\n";
+		return false;
+	}
+	// load the model and fit its bounds into a 330 unit cube resting on the middle of the floor
+	auto makeMesh = [&](MeshData& mesh) {
+		if (!MeshLoader::load(options.meshPath, mesh) || mesh.triangleCount() == 0) return false;
+		auto loaded = std::chrono::high_resolution_clock::now();
+		std::cout << "Loaded " << mesh.positions.size() << " vertices, " << mesh.triangleCount() << " triangles in "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(loaded - start) << std::endl;
+
+		AxisAlignedBoundingBox bounds;
+		for (const auto& p : mesh.positions)
+			bounds = AxisAlignedBoundingBox(bounds, AxisAlignedBoundingBox(p, p));
+		auto extent = std::max({ bounds.x.size(), bounds.y.size(), bounds.z.size() });
+		auto scale = extent > 0 ? 330 / extent : 1;
+		auto center = bounds.centroid();
+		for (auto& p : mesh.positions)
+			p = Point3(278 + (p.x() - center.x()) * scale, (p.y() - bounds.y.min) * scale, 278 + (p.z() - center.z()) * scale);
+		return true;
+	};
+	auto modelMaterial = make_shared<Lambertian>(Color(0.8, 0.6, 0.2));
+	shared_ptr<TriangleMesh> model;
+	if (options.meshCachePath.empty()) {
+		MeshData mesh;
+		if (makeMesh(mesh)) model = make_shared<TriangleMesh>(std::move(mesh), modelMaterial, options.bvhOptions());
+	}
+	else {
+		ContentHash key; // the model's bytes and what makeMesh does to them
+		key.add(std::string_view("meshScene: fit into 330 cube at (278, 0, 278)"));
+		if (key.addFile(options.meshPath)) model = TriangleMesh::cached(options.meshCachePath, key, modelMaterial, makeMesh, options.bvhOptions());
+	}
+	if (!model) return false;
+
+	HittableList world;
+
+	auto red = make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
+	auto white = make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
+	auto green = make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
+	auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
+
+	world.add(make_shared<Quad>(Point3(555, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), green));
+	world.add(make_shared<Quad>(Point3(0, 0, 0), Vec3(0, 555, 0), Vec3(0, 0, 555), red));
+	world.add(make_shared<Quad>(Point3(343, 554, 332), Vec3(-130, 0, 0), Vec3(0, 0, -105), light));
+	world.add(make_shared<Quad>(Point3(0, 0, 0), Vec3(555, 0, 0), Vec3(0, 0, 555), white));
+	world.add(make_shared<Quad>(Point3(555, 555, 555), Vec3(-555, 0, 0), Vec3(0, 0, -555), white));
+	world.add(make_shared<Quad>(Point3(0, 0, 555), Vec3(555, 0, 0), Vec3(0, 555, 0), white));
+	world.add(model);
+
+	Camera cam;
+	cam.aspectRatio = 1.0;
+	cam.imageWidth = 600;
+	cam.samplePerPixel = 64;
+	cam.maxDepth = 30;
+	cam.background = Color(0.0, 0.0, 0.0);
+
+	cam.vfov = 40;
+	cam.lookFrom = Point3(278, 278, -800);
+	cam.lookAt = Point3(278, 278, 0);
+	cam.vUp = Vec3(0, 1, 0);
+
+	cam.defocusAngle = 0;
+
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
+}
+
+/*
+	The final scene's cluster of 1000 spheres, built once and placed 40 x 40 times over the ground, every
+	copy turned, tipped and scaled at random: 1.6 million spheres in the picture for the memory of 1000
+	plus one Instance per copy, under a BVH over the instances.
+*/
+auto instancedScene(const RenderOptions& options) -> bool {
+	auto start = std::chrono::high_resolution_clock::now();
+	auto sharedCluster = make_shared<SphereSet>();
+	auto white = make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
+	for (int j = 0; j < 1000; j++)
+		sharedCluster->add(Point3::random(0, 165), 10, white);
+	sharedCluster->build(options.bvhOptions(SphereSet::defaultOptions()));
+
+	HittableList instances;
+	int perSide = 40;
+	for (int i = 0; i < perSide; i++) {
+		for (int j = 0; j < perSide; j++) {
+			auto scale = randomDouble(0.3, 0.6);
+			auto place = AffineTransform::translation(Vec3(-2000 + 100 * i + 50, 10, -2000 + 100 * j + 50))
+				* AffineTransform::rotation(Vec3(randomDouble(-20, 20), randomDouble(0, 360), 0))
+				* AffineTransform::scaling(Vec3(scale, scale, scale))
+				* AffineTransform::translation(Vec3(-82.5, 0, -82.5)); // turn about the cluster's middle
+			instances.add(make_shared<Instance>(sharedCluster, place));
+		}
+	}
+
+	HittableList world;
+	world.add(make_shared<BoundingVolumeHierarchy>(instances, options.bvhOptions()));
+	world.add(make_shared<Sphere>(Point3(0, -100000, 0), 100000, make_shared<Lambertian>(Color(0.48, 0.83, 0.53))));
+
+	Camera cam;
+	cam.aspectRatio = 16.0 / 9.0;
+	cam.imageWidth = 800;
+	cam.samplePerPixel = 64;
+	cam.maxDepth = 20;
+	cam.background = Color(0.7, 0.8, 1.0);
+
+	cam.vfov = 40;
+	cam.lookFrom = Point3(0, 700, -2600);
+	cam.lookAt = Point3(0, 0, -200);
+	cam.vUp = Vec3(0, 1, 0);
+
+	cam.defocusAngle = 0;
+
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
+}
+
+/*
+	Many lights, the light tree's benchmark: a city block grid at night, lit by 1440 street lamps (emissive
+	spheres in a SphereSet), lit windows on the buildings (emissive quads) and a neon ring over the middle
+	crossing (an emissive triangle mesh, a light per triangle), 5000 lights or so. From any one point only
+	the few lamps and windows nearby matter, which uniform light picking rarely finds
+	(compare with --uniform-lights).
+*/
+auto cityLights(const RenderOptions& options) -> bool {
+	auto start = std::chrono::high_resolution_clock::now();
+	HittableList world;
+	world.add(make_shared<Quad>(Point3(-1000, 0, -1000), Vec3(0, 0, 2000), Vec3(2000, 0, 0), make_shared<Lambertian>(Color(0.3, 0.3, 0.32))));
+
+	// blocks of blockSize with streets of streetWidth between them, centered on the origin
+	const int blocksPerSide = 16;
+	const Real blockSize = 20, streetWidth = 10, period = blockSize + streetWidth;
+	const Real extent = blocksPerSide * period - streetWidth;
+	auto corner = [&](int i) { return -extent / 2 + i * period; };
+
+	HittableList buildings;
+	auto concrete = make_shared<Lambertian>(Color(0.55, 0.52, 0.5));
+	shared_ptr<Material> windowColors[] = {
+		make_shared<DiffuseLight>(Color(6, 5, 3)),
+		make_shared<DiffuseLight>(Color(3, 4, 6)),
+		make_shared<DiffuseLight>(Color(6, 3, 2)),
+	};
+	for (int i = 0; i < blocksPerSide; i++) {
+		for (int j = 0; j < blocksPerSide; j++) {
+			auto x0 = corner(i), z0 = corner(j);
+			auto height = randomDouble(10, 60);
+			buildings.add(box(Point3(x0, 0, z0), Point3(x0 + blockSize, height, z0 + blockSize), concrete));
+			// a few lit windows on each side, just off the walls
+			for (int w = 0; w < 8; w++) {
+				auto along = randomDouble(1, blockSize - 3), up = randomDouble(2, height - 4);
+				auto light = windowColors[randomInt(0, 2)];
+				switch (w % 4) {
+					case 0: buildings.add(make_shared<Quad>(Point3(x0 + along, up, z0 - 0.05), Vec3(2, 0, 0), Vec3(0, 2, 0), light)); break;
+					case 1: buildings.add(make_shared<Quad>(Point3(x0 + along, up, z0 + blockSize + 0.05), Vec3(2, 0, 0), Vec3(0, 2, 0), light)); break;
+					case 2: buildings.add(make_shared<Quad>(Point3(x0 - 0.05, up, z0 + along), Vec3(0, 0, 2), Vec3(0, 2, 0), light)); break;
+					default: buildings.add(make_shared<Quad>(Point3(x0 + blockSize + 0.05, up, z0 + along), Vec3(0, 0, 2), Vec3(0, 2, 0), light)); break;
+				}
+			}
+		}
+	}
+	world.add(make_shared<BoundingVolumeHierarchy>(buildings, options.bvhOptions()));
+
+	// street lamps down the middle of every street, one every 10 units
+	auto lamps = make_shared<SphereSet>();
+	auto lampLight = make_shared<DiffuseLight>(Color(40, 30, 15));
+	for (int street = 0; street < blocksPerSide - 1; street++) {
+		auto middle = corner(street) + blockSize + streetWidth / 2;
+		for (Real t = -extent / 2; t <= extent / 2; t += 10) {
+			lamps->add(Point3(middle, 6, t), 0.4, lampLight);
+			lamps->add(Point3(t, 6, middle), 0.4, lampLight);
+		}
+	}
+	lamps->build(options.bvhOptions(SphereSet::defaultOptions()));
+	world.add(lamps);
+
+	// neon ring: torus of radius 12 around a tube of radius 0.6, standing over the middle crossing
+	MeshData ring;
+	const int around = 96, tube = 8;
+	for (int a = 0; a < around; a++) {
+		auto theta = 2 * pi * a / around;
+		for (int b = 0; b < tube; b++) {
+			auto phi = 2 * pi * b / tube;
+			auto r = 12 + 0.6 * cos(phi);
+			ring.positions.push_back(Point3(r * cos(theta), 30 + r * sin(theta), 0.6 * sin(phi)));
+		}
+	}
+	for (uint32_t a = 0; a < around; a++) {
+		for (uint32_t b = 0; b < tube; b++) {
+			uint32_t p00 = a * tube + b, p01 = a * tube + (b + 1) % tube;
+			uint32_t p10 = (a + 1) % around * tube + b, p11 = (a + 1) % around * tube + (b + 1) % tube;
+			ring.indices.insert(ring.indices.end(), { p00, p10, p11, p00, p11, p01 });
+		}
+	}
+	world.add(make_shared<TriangleMesh>(std::move(ring), make_shared<DiffuseLight>(Color(2, 10, 14)), options.bvhOptions()));
+
+	Camera cam;
+	cam.aspectRatio = 16.0 / 9.0;
+	cam.imageWidth = 800;
+	cam.samplePerPixel = 64;
+	cam.maxDepth = 8;
+	cam.background = Color(0.01, 0.01, 0.02);
+
+	cam.vfov = 45;
+	cam.lookFrom = Point3(-80, 140, -360);
+	cam.lookAt = Point3(0, 0, -40);
+	cam.vUp = Vec3(0, 1, 0);
+
+	cam.defocusAngle = 0;
+
+	options.applyTo(cam);
+	auto rendered = cam.render(world);
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start) << std::endl;
+	return rendered;
+}
+
+bool finalScene(int imageWidth, int samplesPerPixel, int maxDepth, const RenderOptions& options) {
 	HittableList boxes1;
 	auto ground = make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
 
@@ -341,7 +587,7 @@ void finalScene(int imageWidth, int samplesPerPixel, int maxDepth) {
 
 	HittableList world;
 
-	world.add(make_shared<BoundingVolumeHierarchyNode>(boxes1));
+	world.add(make_shared<BoundingVolumeHierarchy>(boxes1, options.bvhOptions()));
 
 	auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
 	world.add(make_shared<Quad>(Point3(123, 554, 147), Vec3(300, 0, 0), Vec3(0, 0, 265), light));
@@ -367,16 +613,16 @@ void finalScene(int imageWidth, int samplesPerPixel, int maxDepth) {
 	auto pertext = make_shared<NoiseTexture>(0.1);
 	world.add(make_shared<Sphere>(Point3(220, 280, 300), 80, make_shared<Lambertian>(pertext)));
 
-	HittableList boxes2;
+	auto boxes2 = make_shared<SphereSet>();
 	auto white = make_shared<Lambertian>(Color(.73, .73, .73));
 	int ns = 1000;
 	for (int j = 0; j < ns; j++) {
-		boxes2.add(make_shared<Sphere>(Point3::random(0, 165), 10, white));
+		boxes2->add(Point3::random(0, 165), 10, white);
 	}
+	boxes2->build(options.bvhOptions(SphereSet::defaultOptions()));
 
 	world.add(make_shared<Translate>(
-		make_shared<Rotate>(
-			make_shared<BoundingVolumeHierarchyNode>(boxes2), Vec3(0, 15, 0)),
+		make_shared<Rotate>(boxes2, Vec3(0, 15, 0)),
 		Vec3(-100, 270, 395)
 	));
 
@@ -395,21 +641,30 @@ void finalScene(int imageWidth, int samplesPerPixel, int maxDepth) {
 
 	cam.defocusAngle = 0;
 
-	cam.render(world);
+	options.applyTo(cam);
+	return cam.render(world);
 }
 
 
-int main() {
-	switch (7) {
-		case 1: randomSpheres(); break;
-		case 2: twoSpheres(); break;
-		case 3: earth(); break;
-		case 4: twoPerlinSpheres(); break;
-		case 5: quads(); break;
-		case 6: simpleLight(); break;
-		case 7: cornellBox(); break;
-		case 8: cornellSmoke(); break;
-		case 9: finalScene(800, 7500, 40); break;
-		default: finalScene(400, 250, 4); break;
+int main(int argc, char* argv[]) {
+	RenderOptions options;
+	if (!RenderOptions::parse(argc, argv, options))
+		return 1;
+	bool rendered = false;
+	switch (options.scene) {
+		case 1: rendered = randomSpheres(options); break;
+		case 2: rendered = twoSpheres(options); break;
+		case 3: rendered = earth(options); break;
+		case 4: rendered = twoPerlinSpheres(options); break;
+		case 5: rendered = quads(options); break;
+		case 6: rendered = simpleLight(options); break;
+		case 7: rendered = cornellBox(options); break;
+		case 8: rendered = cornellSmoke(options); break;
+		case 9: rendered = finalScene(800, 7500, 40, options); break;
+		case 10: rendered = meshScene(options); break;
+		case 11: rendered = instancedScene(options); break;
+		case 12: rendered = cityLights(options); break;
+		default: rendered = finalScene(400, 250, 4, options); break;
 	}
+	return rendered ? 0 : 1;
 }
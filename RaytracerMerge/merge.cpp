@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+#include "AccumulationBuffer.hpp"
+#include "ImageWriter.hpp"
+#include "ThreadPool.hpp"
+
+/*
+	Combines the partial accumulation files written by Raytracer --partial into one image.
+	Every part holds raw per pixel sums and sample counts, so adding them up weights each pixel by
+	the samples it actually received, no matter how the frame was split (tiles, samples or both).
+	Split by tiles, the merged image is bit-identical to a single process render. Split by samples
+	(--part, --samples), each pixel's sums are added in a different order, so it matches only up to rounding.
+	Every part has to come from the same render (samples per pixel). Two parts with the same seed whose
+	sample ranges overlap on a pixel both rendered are refused, so a part passed twice isn't counted twice.
+		RaytracerMerge <output image> <partial> [<partial> ...]
+*/
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cerr << "usage: RaytracerMerge <output image (.ppm, .pfm, .exr)> <partial> [<partial> ...]\n";
+		return 1;
+	}
+	std::string outputPath = argv[1];
+
+	// what each part already merged covers, to catch two parts holding the same samples of a pixel
+	struct Coverage {
+		const char* path;
+		AccumulationInfo info;
+		std::vector<uint8_t> rendered;
+	};
+	std::vector<Coverage> parts;
+	AccumulationBuffer merged(0, 0);
+	AccumulationInfo mergedInfo;
+	for (int a = 2; a < argc; a++) {
+		AccumulationBuffer part(0, 0);
+		AccumulationInfo info;
+		if (!AccumulationBuffer::load(argv[a], part, info)) {
+			std::cerr << "ERROR: Could not read partial '" << argv[a] << "'.\n";
+			return 1;
+		}
+		Coverage coverage{ argv[a], info, std::vector<uint8_t>(part.size()) };
+		for (size_t p = 0; p < part.size(); p++)
+			coverage.rendered[p] = part.sampleCount[p] > 0;
+		if (a == 2) {
+			merged = std::move(part);
+			mergedInfo = info;
+			parts.push_back(std::move(coverage));
+			continue;
+		}
+		if (info.sampleTarget != mergedInfo.sampleTarget) {
+			std::cerr << "ERROR: '" << argv[a] << "' is from a render of " << info.sampleTarget << " samples per pixel, expected "
+				<< mergedInfo.sampleTarget << ".\n";
+			return 1;
+		}
+		if (info.seed != mergedInfo.seed)
+			std::cerr << "WARNING: '" << argv[a] << "' was rendered with a different seed, parts may repeat samples.\n";
+		for (const auto& other : parts) {
+			auto overlap = other.info.seed == info.seed
+				&& std::max(other.info.sampleBegin, info.sampleBegin) < std::min(other.info.sampleEnd, info.sampleEnd);
+			if (!overlap || other.rendered.size() != coverage.rendered.size()) continue; // sizes are reported below
+			for (size_t p = 0; p < coverage.rendered.size(); p++) {
+				if (other.rendered[p] && coverage.rendered[p]) {
+					std::cerr << "ERROR: '" << argv[a] << "' holds samples '" << other.path << "' already has (samples "
+						<< info.sampleBegin << ':' << info.sampleEnd << " against " << other.info.sampleBegin << ':' << other.info.sampleEnd
+						<< " of the same pixels).\n";
+					return 1;
+				}
+			}
+		}
+		parts.push_back(std::move(coverage));
+		if (!merged.merge(part)) {
+			std::cerr << "ERROR: '" << argv[a] << "' is " << part.width << 'x' << part.height
+				<< ", expected " << merged.width << 'x' << merged.height << ".\n";
+			return 1;
+		}
+	}
+
+	size_t missing = 0;
+	uint64_t samples = 0;
+	for (size_t p = 0; p < merged.size(); p++) {
+		missing += merged.sampleCount[p] == 0;
+		samples += merged.sampleCount[p];
+	}
+	std::cout << "Merged " << (argc - 2) << " parts, " << samples << " samples";
+	if (missing > 0)
+		std::cout << ", " << missing << " pixels were not rendered by any part";
+	std::cout << ".\n";
+
+	ThreadPool threadPool;
+	auto writer = imageWriterFor(outputPath);
+	return writer->write(merged.resolve(), outputPath, threadPool) ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Build Raytracer in double and in single (RAYTRACER_SINGLE_PRECISION) precision and time
+# the same scene with each, writing both images so they can be compared side by side.
+# Builds with the system compiler on the way (Linux testing setup).
+#   scripts/benchmark-precision.sh [scene] [runs] [extra render options...]
+set -e
+
+SCENE=${1:-7}
+RUNS=${2:-3}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+BUILD="$REPO/build"
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++20 -O2 -march=native -pthread}
+
+mkdir -p "$BUILD" "$REPO/Raytracer/out"
+$CXX $CXXFLAGS "$REPO/Raytracer/main.cpp" -o "$BUILD/Raytracer-double"
+$CXX $CXXFLAGS -DRAYTRACER_SINGLE_PRECISION "$REPO/Raytracer/main.cpp" -o "$BUILD/Raytracer-float"
+
+cd "$REPO/Raytracer" # scenes look for their textures relative to here
+for PRECISION in double float; do
+	BEST=""
+	i=0
+	while [ "$i" -lt "$RUNS" ]; do
+		START=$(date +%s%N)
+		"$BUILD/Raytracer-$PRECISION" "$SCENE" --output "$BUILD/precision-$PRECISION.pfm" "$@" > /dev/null
+		END=$(date +%s%N)
+		MS=$(( (END - START) / 1000000 ))
+		if [ -z "$BEST" ] || [ "$MS" -lt "$BEST" ]; then BEST=$MS; fi
+		i=$((i + 1))
+	done
+	echo "$PRECISION: best of $RUNS runs ${BEST} ms, image $BUILD/precision-$PRECISION.pfm"
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Render one frame as several local processes, each taking an equal slice of every pixel's samples,
+# then merge the partial accumulations into the final image.
+# Builds Raytracer and RaytracerMerge with the system compiler on the way (Linux testing setup).
+#   scripts/render-distributed.sh [processes] [scene] [output image]
+set -e
+
+PROCESSES=${1:-4}
+SCENE=${2:-7}
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+OUTPUT=$(realpath -m "${3:-$REPO/Raytracer/out/image.ppm}")
+BUILD="$REPO/build"
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++20 -O2 -march=native -pthread}
+
+mkdir -p "$BUILD" "$REPO/Raytracer/out" "$(dirname "$OUTPUT")"
+$CXX $CXXFLAGS "$REPO/Raytracer/main.cpp" -o "$BUILD/Raytracer"
+$CXX $CXXFLAGS -I"$REPO/Raytracer" "$REPO/RaytracerMerge/merge.cpp" -o "$BUILD/RaytracerMerge"
+
+THREADS=$(( $(nproc) / PROCESSES ))
+[ "$THREADS" -lt 1 ] && THREADS=1
+
+cd "$REPO/Raytracer" # scenes look for their textures relative to here
+PARTS=""
+PIDS=""
+i=0
+while [ "$i" -lt "$PROCESSES" ]; do
+	PART="$BUILD/part$i.rtab"
+	rm -f "$PART" # a part that fails to write must not leave an earlier run's in its place
+	"$BUILD/Raytracer" "$SCENE" --part "$i/$PROCESSES" --threads "$THREADS" --partial "$PART" > "$BUILD/part$i.log" &
+	PIDS="$PIDS $!"
+	PARTS="$PARTS $PART"
+	i=$((i + 1))
+done
+for PID in $PIDS; do
+	wait "$PID"
+done
+
+"$BUILD/RaytracerMerge" "$OUTPUT" $PARTS